@@ -0,0 +1,203 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <lightgrid/grid.hpp>
+
+// Reference broadphase implementations the grid is compared against. Each finds every pair (i, j), i < j,
+//      of overlapping bounds, using the same strict overlap test.
+
+namespace baselines {
+
+    using pair_list = std::vector<std::pair<int, int>>;
+
+    inline bool overlapping(const lightgrid::bounds& a, const lightgrid::bounds& b) {
+        return a.x < b.x + b.w && b.x < a.x + a.w && a.y < b.y + b.h && b.y < a.y + a.h;
+    }
+
+    // Sorted pairs, so the results of different implementations can be compared directly
+    inline void normalize(pair_list& pairs) {
+        for (auto& pair : pairs) {
+            if (pair.first > pair.second) {
+                std::swap(pair.first, pair.second);
+            }
+        }
+
+        std::sort(pairs.begin(), pairs.end());
+    }
+
+    inline void brute_force(const std::vector<lightgrid::bounds>& bounds, pair_list& pairs) {
+        for (int i{0}; i < bounds.size(); i++) {
+            for (int j{i + 1}; j < bounds.size(); j++) {
+                if (overlapping(bounds[i], bounds[j])) {
+                    pairs.emplace_back(i, j);
+                }
+            }
+        }
+    }
+
+    /**
+    * @brief Loose quadtree, where each node's bounds are doubled so every entity is stored in exactly one
+    *   node: the deepest one whose cell contains the entity's centre and is at least as large as the entity.
+    */
+    class loose_quadtree {
+    public:
+        loose_quadtree(int map_width, int map_height, int max_depth=8);
+
+        void build(const std::vector<lightgrid::bounds>& bounds);
+        void find_pairs(const std::vector<lightgrid::bounds>& bounds, pair_list& pairs) const;
+
+    private:
+        struct node {
+            int x, y, size; // Tight bounds, the loose bounds extend half the size on every side
+            std::array<int, 4> children{-1, -1, -1, -1};
+            std::vector<int> entities;
+        };
+
+        int insert_node(int x, int y, int size);
+        void insert(int entity, const lightgrid::bounds& bounds);
+        void query(int node, int entity, const std::vector<lightgrid::bounds>& bounds, pair_list& pairs) const;
+
+        int root_size;
+        int max_depth;
+        std::vector<node> nodes;
+    };
+
+    // Sweep and prune along the x-axis, with the entities ordered by an LSD radix sort of their left edge
+    inline void sweep_and_prune(const std::vector<lightgrid::bounds>& bounds, pair_list& pairs) {
+        const size_t num_entities{bounds.size()};
+
+        // Left edges are biased so negative coordinates still sort correctly as unsigned keys
+        std::vector<uint64_t> keys(num_entities), sorted(num_entities);
+
+        for (size_t it{0}; it < num_entities; it++) {
+            keys[it] = (static_cast<uint64_t>(static_cast<uint32_t>(bounds[it].x) ^ 0x80000000u) << 32) | it;
+        }
+
+        for (int shift{32}; shift < 64; shift += 8) {
+            std::array<size_t, 257> digit_offsets{};
+
+            for (auto key : keys) {
+                digit_offsets[((key >> shift) & 0xff) + 1]++;
+            }
+            for (size_t digit{1}; digit < digit_offsets.size(); digit++) {
+                digit_offsets[digit] += digit_offsets[digit - 1];
+            }
+            for (auto key : keys) {
+                sorted[digit_offsets[(key >> shift) & 0xff]++] = key;
+            }
+
+            std::swap(keys, sorted);
+        }
+
+        for (size_t i{0}; i < num_entities; i++) {
+            const int first = static_cast<uint32_t>(keys[i]);
+            const lightgrid::bounds& a{bounds[first]};
+
+            // Only entities starting before this one ends can overlap it on the x-axis
+            for (size_t j{i + 1}; j < num_entities; j++) {
+                const int second = static_cast<uint32_t>(keys[j]);
+                const lightgrid::bounds& b{bounds[second]};
+
+                if (b.x >= a.x + a.w) {
+                    break;
+                }
+                if (a.y < b.y + b.h && b.y < a.y + a.h && a.x < b.x + b.w) {
+                    pairs.emplace_back(first, second);
+                }
+            }
+        }
+    }
+
+    inline loose_quadtree::loose_quadtree(int map_width, int map_height, int max_depth) : max_depth{ max_depth } {
+        this->root_size = 1;
+
+        while (this->root_size < std::max(map_width, map_height)) {
+            this->root_size *= 2;
+        }
+    }
+
+    inline void loose_quadtree::build(const std::vector<lightgrid::bounds>& bounds) {
+        this->nodes.clear();
+        this->insert_node(0, 0, this->root_size);
+
+        for (int it{0}; it < bounds.size(); it++) {
+            this->insert(it, bounds[it]);
+        }
+    }
+
+    inline int loose_quadtree::insert_node(int x, int y, int size) {
+        this->nodes.push_back({x, y, size});
+        return this->nodes.size() - 1;
+    }
+
+    inline void loose_quadtree::insert(int entity, const lightgrid::bounds& bounds) {
+        const int centre_x{std::clamp(bounds.x + bounds.w/2, 0, this->root_size - 1)};
+        const int centre_y{std::clamp(bounds.y + bounds.h/2, 0, this->root_size - 1)};
+        const int extent{std::max(bounds.w, bounds.h)};
+
+        int current{0};
+
+        for (int depth{0}; depth < this->max_depth; depth++) {
+            const int child_size{this->nodes[current].size/2};
+
+            // A child's loose bounds only hold the entity if it's no larger than the child's cell
+            if (child_size < extent || child_size == 0) {
+                break;
+            }
+
+            const int quadrant_x{centre_x >= this->nodes[current].x + child_size};
+            const int quadrant_y{centre_y >= this->nodes[current].y + child_size};
+            const int quadrant{quadrant_y*2 + quadrant_x};
+
+            if (this->nodes[current].children[quadrant] == -1) {
+                const int child{this->insert_node(
+                    this->nodes[current].x + quadrant_x*child_size, 
+                    this->nodes[current].y + quadrant_y*child_size, 
+                    child_size
+                )};
+                this->nodes[current].children[quadrant] = child;
+            }
+
+            current = this->nodes[current].children[quadrant];
+        }
+
+        this->nodes[current].entities.push_back(entity);
+    }
+
+    inline void loose_quadtree::find_pairs(const std::vector<lightgrid::bounds>& bounds, pair_list& pairs) const {
+        for (int it{0}; it < bounds.size(); it++) {
+            this->query(0, it, bounds, pairs);
+        }
+    }
+
+    inline void loose_quadtree::query(int node, int entity, const std::vector<lightgrid::bounds>& bounds, pair_list& pairs) const {
+        const auto& current{this->nodes[node]};
+        const int half{current.size/2};
+
+        const lightgrid::bounds loose{current.x - half, current.y - half, current.size*2, current.size*2};
+
+        // Entities may sit exactly on the edge of the loose bounds, so touching counts here
+        const lightgrid::bounds& query{bounds[entity]};
+
+        if (query.x > loose.x + loose.w || loose.x > query.x + query.w || query.y > loose.y + loose.h || loose.y > query.y + query.h) {
+            return;
+        }
+
+        for (auto other : current.entities) {
+            if (other > entity && overlapping(query, bounds[other])) {
+                pairs.emplace_back(entity, other);
+            }
+        }
+
+        for (auto child : current.children) {
+            if (child != -1) {
+                this->query(child, entity, bounds, pairs);
+            }
+        }
+    }
+}
@@ -0,0 +1,430 @@
+#include <string>
+#include <iostream>
+#include <vector>
+#include <iomanip>
+#include <chrono>
+#include <optional>
+#include <cstring>
+
+#include <lightgrid/grid.hpp>
+
+#include "baselines.hpp"
+#include "perf_counters.hpp"
+#include "workloads.hpp"
+
+// Headless benchmark of the grid operations, optionally reading hardware performance 
+//      counters around each operation with --perf. With --compare, the grid's broadphase
+//      is instead compared against the reference implementations in baselines.hpp.
+
+#define GRID_CELL_SIZE 10
+
+struct options {
+    int num_entities{50000};
+    int map_width{1920};
+    int map_height{1080};
+    int min_size{5};
+    int max_size{5};
+    int max_step{3}; // Largest distance an entity moves in an update
+    int iterations{5};
+    uint32_t seed{1};
+    workloads::kind workload{workloads::kind::uniform};
+    lightgrid::dedupe dedupe{lightgrid::dedupe::visited_set};
+    bool perf{false};
+    bool compare{false};
+    int brute_force_max{20000}; // Brute force is skipped above this many entities
+};
+
+struct result {
+    const char* name;
+    uint64_t num_ops{0};
+    double nanoseconds{0};
+    std::array<std::optional<uint64_t>, perf_counters::num_counters> counters;
+};
+
+lightgrid::grid<int, GRID_CELL_SIZE> grid;
+
+std::vector<lightgrid::bounds> entity_bounds;
+std::vector<lightgrid::bounds> moved_bounds;
+std::vector<int> element_nodes;
+std::vector<int> query;
+
+void printUsage();
+bool parseOptions(int argc, char** argv, options& opts);
+void createBounds(const options& opts);
+
+template<typename F>
+void measure(result& result, uint64_t num_ops, perf_counters* perf, F&& operation);
+void printResults(const std::vector<result>& results, bool perf);
+
+void visitCount(int element, void* user_data);
+
+void gridPairs(const std::vector<lightgrid::bounds>& bounds, baselines::pair_list& pairs);
+template<typename F>
+double timePairs(F&& find_pairs, baselines::pair_list& pairs);
+int runComparison(const options& opts);
+
+void printUsage() {
+    std::cout << 
+        "Usage: lightgrid_bench [options]\n"
+        "  --entities N     Number of entities (default 50000)\n"
+        "  --width N        Map width (default 1920)\n"
+        "  --height N       Map height (default 1080)\n"
+        "  --min-size N     Smallest entity side (default 5)\n"
+        "  --max-size N     Largest entity side (default 5)\n"
+        "  --max-step N     Largest distance moved per update (default 3)\n"
+        "  --iterations N   Number of times each operation is repeated (default 5)\n"
+        "  --seed N         Random seed (default 1)\n"
+        "  --workload NAME  Entity layout: uniform, clusters, hotspots, corridors or mixed_sizes (default uniform)\n"
+        "  --dedupe NAME    How queries dedupe elements: visited_set or reference_point (default visited_set)\n"
+        "  --perf           Read hardware performance counters around each operation\n"
+        "  --compare        Compare the grid's broadphase against brute force, a loose quadtree and sweep and prune,\n"
+        "                   over a range of entity counts (up to --entities) and size spreads\n"
+        "  --brute-max N    Largest entity count brute force is run for in --compare (default 20000)\n";
+}
+
+bool parseOptions(int argc, char** argv, options& opts) {
+
+    for (int it{1}; it < argc; it++) {
+
+        const char* arg{argv[it]};
+        const bool has_value{it + 1 < argc};
+
+        if (std::strcmp(arg, "--perf") == 0) {
+            opts.perf = true;
+        } else if (std::strcmp(arg, "--compare") == 0) {
+            opts.compare = true;
+        } else if (has_value && std::strcmp(arg, "--brute-max") == 0) {
+            opts.brute_force_max = std::stoi(argv[++it]);
+        } else if (std::strcmp(arg, "--help") == 0) {
+            return false;
+        } else if (has_value && std::strcmp(arg, "--entities") == 0) {
+            opts.num_entities = std::stoi(argv[++it]);
+        } else if (has_value && std::strcmp(arg, "--width") == 0) {
+            opts.map_width = std::stoi(argv[++it]);
+        } else if (has_value && std::strcmp(arg, "--height") == 0) {
+            opts.map_height = std::stoi(argv[++it]);
+        } else if (has_value && std::strcmp(arg, "--min-size") == 0) {
+            opts.min_size = std::stoi(argv[++it]);
+        } else if (has_value && std::strcmp(arg, "--max-size") == 0) {
+            opts.max_size = std::stoi(argv[++it]);
+        } else if (has_value && std::strcmp(arg, "--max-step") == 0) {
+            opts.max_step = std::stoi(argv[++it]);
+        } else if (has_value && std::strcmp(arg, "--iterations") == 0) {
+            opts.iterations = std::stoi(argv[++it]);
+        } else if (has_value && std::strcmp(arg, "--seed") == 0) {
+            opts.seed = std::stoul(argv[++it]);
+        } else if (has_value && std::strcmp(arg, "--workload") == 0) {
+            auto workload{workloads::parse(argv[++it])};
+
+            if (!workload) {
+                std::cerr << "Unknown workload: " << argv[it] << "\n";
+                return false;
+            }
+
+            opts.workload = *workload;
+        } else if (has_value && std::strcmp(arg, "--dedupe") == 0) {
+            const char* dedupe{argv[++it]};
+
+            if (std::strcmp(dedupe, "visited_set") == 0) {
+                opts.dedupe = lightgrid::dedupe::visited_set;
+            } else if (std::strcmp(dedupe, "reference_point") == 0) {
+                opts.dedupe = lightgrid::dedupe::reference_point;
+            } else {
+                std::cerr << "Unknown dedupe strategy: " << dedupe << "\n";
+                return false;
+            }
+        } else {
+            std::cerr << "Unknown or incomplete option: " << arg << "\n";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void createBounds(const options& opts) {
+
+    entity_bounds = workloads::generate(opts.workload, {
+        opts.num_entities, opts.map_width, opts.map_height, opts.min_size, opts.max_size, opts.seed
+    });
+
+    // Movement uses its own stream so every workload moves by the same steps for a given seed
+    workloads::random rand{opts.seed ^ 0x9e3779b9u};
+
+    moved_bounds.clear();
+
+    for (auto bounds : entity_bounds) {
+
+        bounds.x = std::clamp(bounds.x + rand.uniform_int(-opts.max_step, opts.max_step), 0, std::max(opts.map_width - bounds.w, 0));
+        bounds.y = std::clamp(bounds.y + rand.uniform_int(-opts.max_step, opts.max_step), 0, std::max(opts.map_height - bounds.h, 0));
+
+        moved_bounds.push_back(bounds);
+    }
+}
+
+template<typename F>
+void measure(result& result, uint64_t num_ops, perf_counters* perf, F&& operation) {
+
+    if (perf) {
+        perf->start();
+    }
+
+    auto start{std::chrono::steady_clock::now()};
+    operation();
+    auto end{std::chrono::steady_clock::now()};
+
+    if (perf) {
+        perf->stop();
+
+        for (int it{0}; it < perf_counters::num_counters; it++) {
+
+            auto value{perf->read(static_cast<perf_counters::counter>(it))};
+
+            if (value) {
+                result.counters[it] = result.counters[it].value_or(0) + *value;
+            }
+        }
+    }
+
+    result.num_ops += num_ops;
+    result.nanoseconds += std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+void printResults(const std::vector<result>& results, bool perf) {
+
+    std::cout << std::left << std::setw(10) << "op" << std::right << std::setw(12) << "ops" << std::setw(12) << "ns/op";
+
+    if (perf) {
+        for (auto name : perf_counters::names) {
+            std::cout << std::setw(16) << name;
+        }
+    }
+
+    std::cout << "\n" << std::fixed;
+
+    for (auto& result : results) {
+
+        std::cout << std::left << std::setw(10) << result.name << std::right << std::setw(12) << result.num_ops 
+            << std::setw(12) << std::setprecision(1) << result.nanoseconds/result.num_ops;
+
+        if (perf) {
+            for (auto& counter : result.counters) {
+                if (counter) {
+                    std::cout << std::setw(16) << std::setprecision(3) << *counter/(double)result.num_ops;
+                } else {
+                    std::cout << std::setw(16) << "n/a";
+                }
+            }
+        }
+
+        std::cout << "\n";
+    }
+
+    if (perf) {
+        std::cout << "Performance counters are reported per op\n";
+    }
+}
+
+void visitCount(int element, void* user_data) {
+    (*static_cast<uint64_t*>(user_data))++;
+}
+
+void gridPairs(const std::vector<lightgrid::bounds>& bounds, baselines::pair_list& pairs) {
+
+    // A new grid is used for each run as its construction is negligible next to the insertions
+    lightgrid::grid<int, GRID_CELL_SIZE> pair_grid;
+    std::vector<int> candidates;
+
+    pair_grid.reserve(bounds.size());
+
+    for (int it{0}; it < bounds.size(); it++) {
+        pair_grid.insert(it, bounds[it]);
+    }
+
+    for (int it{0}; it < bounds.size(); it++) {
+
+        candidates.clear();
+        pair_grid.query(bounds[it], candidates);
+
+        for (auto other : candidates) {
+            if (other > it && baselines::overlapping(bounds[it], bounds[other])) {
+                pairs.emplace_back(it, other);
+            }
+        }
+    }
+}
+
+template<typename F>
+double timePairs(F&& find_pairs, baselines::pair_list& pairs) {
+
+    pairs.clear();
+
+    auto start{std::chrono::steady_clock::now()};
+    find_pairs(pairs);
+    auto end{std::chrono::steady_clock::now()};
+
+    baselines::normalize(pairs);
+
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int runComparison(const options& opts) {
+
+    // Timings include building each structure from scratch, as every one of them is rebuilt or 
+    //      updated each frame in a typical broadphase.
+    std::cout << "Workload: " << workloads::name(opts.workload) << ", cell size: " << GRID_CELL_SIZE << ", times in ms\n";
+    std::cout << std::right << std::setw(10) << "entities" << std::setw(10) << "sizes" << std::setw(12) << "pairs"
+        << std::setw(12) << "grid" << std::setw(12) << "brute" << std::setw(12) << "quadtree" << std::setw(12) << "sap"
+        << std::setw(10) << "fastest" << "\n";
+
+    std::vector<int> entity_counts;
+
+    for (int count : {1000, 10000, 50000, 200000}) {
+        if (count < opts.num_entities) {
+            entity_counts.push_back(count);
+        }
+    }
+
+    entity_counts.push_back(opts.num_entities);
+
+    bool all_match{true};
+
+    for (int num_entities : entity_counts) {
+        for (int spread : {1, 4, 16}) {
+
+            const int max_size{opts.max_size*spread};
+
+            const auto bounds{workloads::generate(opts.workload, {
+                num_entities, opts.map_width, opts.map_height, opts.min_size, max_size, opts.seed
+            })};
+
+            baselines::pair_list expected, pairs;
+            std::array<double, 4> times;
+            times.fill(-1);
+
+            times[0] = timePairs([&](auto& pairs) { gridPairs(bounds, pairs); }, expected);
+
+            if (num_entities <= opts.brute_force_max) {
+                times[1] = timePairs([&](auto& pairs) { baselines::brute_force(bounds, pairs); }, pairs);
+                all_match &= pairs == expected;
+            }
+
+            baselines::loose_quadtree quadtree{opts.map_width, opts.map_height};
+            times[2] = timePairs([&](auto& pairs) { quadtree.build(bounds); quadtree.find_pairs(bounds, pairs); }, pairs);
+            all_match &= pairs == expected;
+
+            times[3] = timePairs([&](auto& pairs) { baselines::sweep_and_prune(bounds, pairs); }, pairs);
+            all_match &= pairs == expected;
+
+            const std::array<const char*, 4> names{"grid", "brute", "quadtree", "sap"};
+            int fastest{0};
+
+            for (int it{1}; it < times.size(); it++) {
+                if (times[it] >= 0 && times[it] < times[fastest]) {
+                    fastest = it;
+                }
+            }
+
+            std::cout << std::setw(10) << num_entities << std::setw(10) << (std::to_string(opts.min_size) + "-" + std::to_string(max_size))
+                << std::setw(12) << expected.size() << std::fixed << std::setprecision(2);
+
+            for (auto time : times) {
+                if (time >= 0) {
+                    std::cout << std::setw(12) << time;
+                } else {
+                    std::cout << std::setw(12) << "skipped";
+                }
+            }
+
+            std::cout << std::setw(10) << names[fastest] << "\n";
+        }
+    }
+
+    if (!all_match) {
+        std::cout << "Mismatch: the implementations found different pairs\n";
+        return 1;
+    }
+
+    std::cout << "All implementations found the same pairs\n";
+    return 0;
+}
+
+int main(int argc, char** argv) {
+
+    options opts;
+
+    if (!parseOptions(argc, argv, opts)) {
+        printUsage();
+        return 1;
+    }
+
+    if (opts.compare) {
+        return runComparison(opts);
+    }
+
+    std::optional<perf_counters> perf;
+
+    if (opts.perf) {
+        perf.emplace();
+
+        if (!perf->available()) {
+            std::cout << "Performance counters are unavailable (check perf_event_paranoid or container permissions), reporting time only\n";
+            perf.reset();
+        }
+    }
+
+    perf_counters* perf_ptr{perf ? &*perf : nullptr};
+
+    createBounds(opts);
+
+    const uint64_t num_entities = entity_bounds.size();
+
+    std::vector<result> results{{"insert"}, {"query"}, {"visit"}, {"update"}, {"remove"}};
+    uint64_t num_visited{0};
+
+    grid.reserve(num_entities);
+    grid.set_dedupe(opts.dedupe);
+    query.reserve(num_entities);
+    element_nodes.resize(num_entities);
+
+    for (int iteration{0}; iteration < opts.iterations; iteration++) {
+
+        measure(results[0], num_entities, perf_ptr, [&] {
+            for (int it{0}; it < num_entities; it++) {
+                element_nodes[it] = grid.insert(it, entity_bounds[it]);
+            }
+        });
+
+        measure(results[1], num_entities, perf_ptr, [&] {
+            for (int it{0}; it < num_entities; it++) {
+                query.clear();
+                grid.query(entity_bounds[it], query);
+            }
+        });
+
+        measure(results[2], num_entities, perf_ptr, [&] {
+            for (int it{0}; it < num_entities; it++) {
+                grid.visit<visitCount>(entity_bounds[it], &num_visited);
+            }
+        });
+
+        measure(results[3], num_entities, perf_ptr, [&] {
+            for (int it{0}; it < num_entities; it++) {
+                grid.update(element_nodes[it], entity_bounds[it], moved_bounds[it]);
+            }
+        });
+
+        measure(results[4], num_entities, perf_ptr, [&] {
+            for (int it{0}; it < num_entities; it++) {
+                grid.remove(element_nodes[it], moved_bounds[it]);
+            }
+        });
+    }
+
+    std::cout << "Workload: " << workloads::name(opts.workload) << ", entities: " << num_entities << ", iterations: " << opts.iterations << ", cell size: " << GRID_CELL_SIZE 
+        << ", dedupe: " << (opts.dedupe == lightgrid::dedupe::visited_set ? "visited_set" : "reference_point") << ", visited: " << num_visited << "\n";
+
+    printResults(results, perf.has_value());
+
+    return 0;
+}
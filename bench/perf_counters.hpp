@@ -0,0 +1,150 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+
+#ifdef __linux__
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+// Reads hardware performance counters for the calling thread through perf_event_open.
+//      Each counter is opened on its own, so counters which aren't supported or permitted (such as 
+//      under a restrictive perf_event_paranoid, in containers, or on other platforms) are simply 
+//      reported as unavailable while the others keep working.
+class perf_counters {
+public:
+    enum counter {
+        instructions,
+        branch_misses,
+        l1d_misses,
+        llc_misses,
+        dtlb_misses,
+        num_counters
+    };
+
+    static constexpr std::array<const char*, num_counters> names{
+        "instructions", "branch-misses", "L1d-misses", "LLC-misses", "dTLB-misses"
+    };
+
+    perf_counters();
+    ~perf_counters();
+
+    perf_counters(const perf_counters&) = delete;
+    perf_counters& operator=(const perf_counters&) = delete;
+
+    void start();
+    void stop();
+
+    bool available() const;
+    // Value counted between the last start and stop, scaled up if the counter was multiplexed
+    std::optional<uint64_t> read(counter counter) const;
+
+private:
+    std::array<int, num_counters> fds;
+};
+
+#ifdef __linux__
+
+inline perf_counters::perf_counters() {
+    const auto cache_miss = [](uint64_t cache) {
+        return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    };
+
+    const std::array<std::pair<uint32_t, uint64_t>, num_counters> configs{{
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_L1D)},
+        {PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_LL)},
+        {PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_DTLB)}
+    }};
+
+    for (int it{0}; it < num_counters; it++) {
+        perf_event_attr attr{};
+
+        attr.size = sizeof(attr);
+        attr.type = configs[it].first;
+        attr.config = configs[it].second;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        // Fails with -1 where the counter isn't permitted or supported
+        this->fds[it] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+}
+
+inline perf_counters::~perf_counters() {
+    for (auto fd : this->fds) {
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+}
+
+inline void perf_counters::start() {
+    for (auto fd : this->fds) {
+        if (fd != -1) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+inline void perf_counters::stop() {
+    for (auto fd : this->fds) {
+        if (fd != -1) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+}
+
+inline bool perf_counters::available() const {
+    for (auto fd : this->fds) {
+        if (fd != -1) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+inline std::optional<uint64_t> perf_counters::read(counter counter) const {
+    if (this->fds[counter] == -1) {
+        return std::nullopt;
+    }
+
+    // value, time enabled, time running
+    std::array<uint64_t, 3> values{};
+
+    if (::read(this->fds[counter], values.data(), sizeof(values)) != sizeof(values) || values[2] == 0) {
+        return std::nullopt;
+    }
+
+    // The kernel multiplexes counters when there are more than the hardware can track at once
+    return static_cast<uint64_t>(values[0]*(static_cast<double>(values[1])/values[2]));
+}
+
+#else
+
+inline perf_counters::perf_counters() {
+    this->fds.fill(-1);
+}
+
+inline perf_counters::~perf_counters() {}
+inline void perf_counters::start() {}
+inline void perf_counters::stop() {}
+
+inline bool perf_counters::available() const {
+    return false;
+}
+
+inline std::optional<uint64_t> perf_counters::read(counter counter) const {
+    return std::nullopt;
+}
+
+#endif
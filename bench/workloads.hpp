@@ -0,0 +1,204 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <array>
+
+#include <lightgrid/grid.hpp>
+
+// Seeded entity layouts for benchmarking the grid on realistic densities.
+//      Only the raw output of std::mt19937 is used, which is fully specified by the standard,
+//      so a seed gives the same layout with every standard library.
+
+namespace workloads {
+
+    enum class kind {
+        uniform, // Evenly spread over the whole map
+        clusters, // Gaussian clusters of varying spread
+        hotspots, // Tight spots chosen with a Zipf distribution, so a few spots hold most entities
+        corridors, // Along a network of horizontal and vertical roads
+        mixed_sizes, // Evenly spread, with mostly small entities and a long tail of large ones
+        num_kinds
+    };
+
+    inline constexpr std::array<const char*, static_cast<size_t>(kind::num_kinds)> names{
+        "uniform", "clusters", "hotspots", "corridors", "mixed_sizes"
+    };
+
+    struct workload_options {
+        int num_entities{50000};
+        int map_width{1920};
+        int map_height{1080};
+        int min_size{5};
+        int max_size{5};
+        uint32_t seed{1};
+    };
+
+    class random {
+    public:
+        random(uint32_t seed) : gen{ seed } {}
+
+        // Uniform in [min, max]
+        int uniform_int(int min, int max) {
+            return min + static_cast<int>((static_cast<uint64_t>(this->gen())*(static_cast<uint64_t>(max - min) + 1)) >> 32);
+        }
+
+        // Uniform in [0, 1)
+        double uniform() {
+            return this->gen()/4294967296.0;
+        }
+
+        // Box-Muller transform
+        double normal(double mean, double stddev) {
+            const double u1{1.0 - this->uniform()};
+            const double u2{this->uniform()};
+
+            return mean + stddev*std::sqrt(-2.0*std::log(u1))*std::cos(6.283185307179586*u2);
+        }
+
+    private:
+        std::mt19937 gen;
+    };
+
+    inline const char* name(kind kind) {
+        return names[static_cast<size_t>(kind)];
+    }
+
+    inline std::optional<kind> parse(const char* name) {
+        for (size_t it{0}; it < names.size(); it++) {
+            if (std::strcmp(names[it], name) == 0) {
+                return static_cast<kind>(it);
+            }
+        }
+
+        return std::nullopt;
+    }
+
+    // Places the bounds centred on (x, y), keeping them inside the map
+    inline lightgrid::bounds place(const workload_options& opts, double x, double y, int w, int h) {
+        return {
+            std::clamp(static_cast<int>(x) - w/2, 0, std::max(opts.map_width - w, 0)),
+            std::clamp(static_cast<int>(y) - h/2, 0, std::max(opts.map_height - h, 0)),
+            w, h
+        };
+    }
+
+    inline std::vector<lightgrid::bounds> generate(kind kind, const workload_options& opts) {
+
+        random rand{opts.seed};
+
+        std::vector<lightgrid::bounds> bounds;
+        bounds.reserve(opts.num_entities);
+
+        const auto size = [&] {
+            return rand.uniform_int(opts.min_size, opts.max_size);
+        };
+
+        switch (kind) {
+
+            case kind::uniform:
+            case kind::num_kinds: {
+                for (int it{0}; it < opts.num_entities; it++) {
+                    const int w{size()};
+                    const int h{size()};
+                    bounds.push_back({rand.uniform_int(0, opts.map_width - w), rand.uniform_int(0, opts.map_height - h), w, h});
+                }
+                break;
+            }
+
+            case kind::clusters: {
+                const int num_clusters{std::max(1, static_cast<int>(std::sqrt(opts.num_entities)/4))};
+                const int shorter_side{std::min(opts.map_width, opts.map_height)};
+
+                struct cluster { double x, y, spread; };
+                std::vector<cluster> clusters;
+
+                for (int it{0}; it < num_clusters; it++) {
+                    clusters.push_back({
+                        rand.uniform()*opts.map_width, 
+                        rand.uniform()*opts.map_height, 
+                        shorter_side*(0.01 + 0.05*rand.uniform())
+                    });
+                }
+
+                for (int it{0}; it < opts.num_entities; it++) {
+                    const cluster& cluster{clusters[rand.uniform_int(0, num_clusters - 1)]};
+                    bounds.push_back(place(opts, rand.normal(cluster.x, cluster.spread), rand.normal(cluster.y, cluster.spread), size(), size()));
+                }
+                break;
+            }
+
+            case kind::hotspots: {
+                constexpr int num_hotspots{64};
+                constexpr double exponent{1.1};
+
+                const int shorter_side{std::min(opts.map_width, opts.map_height)};
+
+                // Cumulative Zipf weights, so the hotspot with rank k is chosen with probability proportional to 1/k^s
+                std::vector<double> cumulative(num_hotspots);
+                std::vector<std::pair<double, double>> hotspots;
+                double total{0};
+
+                for (int it{0}; it < num_hotspots; it++) {
+                    total += 1.0/std::pow(it + 1, exponent);
+                    cumulative[it] = total;
+                    hotspots.emplace_back(rand.uniform()*opts.map_width, rand.uniform()*opts.map_height);
+                }
+
+                for (int it{0}; it < opts.num_entities; it++) {
+                    const double choice{rand.uniform()*total};
+                    const int hotspot = std::lower_bound(cumulative.begin(), cumulative.end(), choice) - cumulative.begin();
+                    const auto [x, y] = hotspots[std::min(hotspot, num_hotspots - 1)];
+
+                    bounds.push_back(place(opts, rand.normal(x, shorter_side*0.01), rand.normal(y, shorter_side*0.01), size(), size()));
+                }
+                break;
+            }
+
+            case kind::corridors: {
+                constexpr int num_roads{8}; // In each direction
+                const int road_width{std::max(opts.max_size*4, 16)};
+
+                std::vector<int> horizontal, vertical;
+
+                for (int it{0}; it < num_roads; it++) {
+                    horizontal.push_back(rand.uniform_int(0, opts.map_height));
+                    vertical.push_back(rand.uniform_int(0, opts.map_width));
+                }
+
+                for (int it{0}; it < opts.num_entities; it++) {
+                    const int road{rand.uniform_int(0, num_roads - 1)};
+                    const double across{(rand.uniform() - 0.5)*road_width};
+
+                    if (rand.uniform() < 0.5) {
+                        bounds.push_back(place(opts, rand.uniform()*opts.map_width, horizontal[road] + across, size(), size()));
+                    } else {
+                        bounds.push_back(place(opts, vertical[road] + across, rand.uniform()*opts.map_height, size(), size()));
+                    }
+                }
+                break;
+            }
+
+            case kind::mixed_sizes: {
+                // 80% small, 15% medium and 5% large, where large entities reach 8 times the maximum size
+                for (int it{0}; it < opts.num_entities; it++) {
+                    const double tier{rand.uniform()};
+                    const int max_size{tier < 0.8 ? opts.max_size : tier < 0.95 ? opts.max_size*3 : opts.max_size*8};
+
+                    const int w{rand.uniform_int(opts.min_size, max_size)};
+                    const int h{rand.uniform_int(opts.min_size, max_size)};
+
+                    bounds.push_back(place(opts, rand.uniform()*opts.map_width, rand.uniform()*opts.map_height, w, h));
+                }
+                break;
+            }
+        }
+
+        return bounds;
+    }
+}
@@ -3,10 +3,24 @@
 #include <vector>
 #include <random>
 #include <iomanip>
+#include <chrono>
+#include <cstring>
+#include <cmath>
+#include <utility>
+#include <algorithm>
+#include <bit>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <array>
 
 #include <SDL.h>
 
 #include <lightgrid/grid.hpp>
+#include <lightgrid/thread_pool.hpp>
+
+// These are the defaults, each of which can be changed from the command line (see --help)
 
 #define WINDOW_WIDTH 1920
 #define WINDOW_HEIGHT 1080
@@ -27,6 +41,11 @@
 #define MAX_ENTITY_VELOCITY 15.0f
 #define MIN_ENTITY_VELOCITY -15.0f
 
+// Frames simulated by --headless when no frame count is given, with a fixed timestep
+//      so that runs are reproducible
+#define HEADLESS_FRAMES 1000
+#define HEADLESS_TIMESTEP (1000.0f/60.0f)
+
 // SDL seems to use a massive amount of memory when drawing many rectangles. 
 //      Still not sure if this is my issue, or SDL's issue; regardless, the memory 
 //      usage is measured separately without the rectangles being rendered. 
@@ -34,12 +53,44 @@
 // Setting this to true will disable SDL drawing
 #define MEASURE_MEMORY false
 
+// The grid's cell size is a template parameter, so only these sizes can be chosen at runtime
+using supported_cell_sizes = std::integer_sequence<int, 1, 2, 3, 4, 5, 6, 8, 10, 12, 16, 20, 25, 32, 50, 64, 100, 128>;
+
+struct options {
+    int num_entities{NUM_ENTITIES};
+    int cell_size{GRID_CELL_SIZE};
+    float min_velocity{MIN_ENTITY_VELOCITY};
+    float max_velocity{MAX_ENTITY_VELOCITY};
+    int num_frames{0}; // 0 runs until the window is closed
+    float timestep{0}; // Milliseconds per frame, 0 uses the real time between frames
+    uint32_t seed{std::mt19937::default_seed};
+    int num_threads{static_cast<int>(std::max(std::thread::hardware_concurrency(), 1u))};
+    bool headless{false};
+    bool pipelined{false};
+};
+
+// Time spent in each phase of the frame, in milliseconds
+struct phase_times {
+    double update{0};
+    double grid_update{0};
+    double broadphase{0};
+    double colour{0};
+    double resolve{0};
+    double cull{0};
+    double wait{0}; // Time spent waiting on the grid update of the next frame when pipelined
+    double render{0};
+    double frame{0};
+};
+
 SDL_Renderer *renderer;
 SDL_Window *window;
 SDL_Event event;
 
 bool quit{false};
 
+options opts;
+phase_times times;
+
 struct entity {
 
     lightgrid::bounds bounds;
@@ -66,40 +117,179 @@ struct entity {
     //      future though. 
 };
 
-// While the grid's performance when querying will not suffer by holding the 
-//      entities directly, there may be a performace penalty during insertion 
-//      and retrieval as a copy of the type will be stored in the grid, and 
-//      this will be copied.
-// It is slightly prefered to insert pointers or indicies into other lists
-//      than it is to store an instance of that type.
-lightgrid::grid<int, GRID_CELL_SIZE> grid;
 std::vector<entity> entities;
 
-// A vector (or some other insertable type) is needed to retrieve the values
-//      within the queried bounds.
-// In a not-so-distant future version, a function such as iterQuery() will
-//      be implemented to avoid any costs associated with retrieval after 
-//      a query in cases where the values returned are all passed to some
-//      functor.
-std::vector<int> query;
+// Resolving a collision changes both entities, so the collisions can't simply be
+//      resolved in parallel. Instead, the overlapping pairs are found first, then
+//      split into batches in which no entity appears twice. The pairs of a batch
+//      can then be resolved in any order, on any thread.
+struct collision_pair {
+    int first;
+    int second;
+};
+
+// A single thread which runs one job at a time alongside the calling thread
+class stage_thread {
+public:
+    stage_thread();
+    ~stage_thread();
+
+    void start(std::function<void()> job);
+    void wait();
+
+private:
+    void work();
+
+    std::mutex mutex;
+    std::condition_variable job_ready;
+    std::condition_variable job_done;
+
+    std::function<void()> job;
+    bool busy{false};
+    bool stopping{false};
+
+    std::thread thread; // Last, so that everything it uses is constructed before it starts
+};
+
+// A job over the range [begin, end) of a larger one, given the index of its chunk
+using chunk_job = std::function<void(size_t begin, size_t end, int thread)>;
+
+// Splits count items into an even chunk for each worker of the pool, with the
+//      calling thread taking part
+void runChunks(lightgrid::thread_pool& workers, size_t count, const chunk_job& job);
+
+// Each thread has its own query context and lists, so the grid can be queried
+//      by all of them at once during the broadphase.
+template<class Grid>
+struct thread_scratch {
+    typename Grid::query_context context;
+    std::vector<int> candidates;
+    std::vector<collision_pair> pairs;
+};
+
+std::vector<collision_pair> pairs;
+
+// Pairs grouped by batch, with the pairs of batch i starting at batch_offsets[i].
+//      The last batch holds the pairs which couldn't be given one of the 64
+//      colours, and is resolved on a single thread.
+std::vector<collision_pair> batches;
+std::vector<size_t> batch_offsets;
+std::vector<uint64_t> used_colours;
+std::vector<uint8_t> pair_colours;
+
+#define NUM_COLOURS 64
+
+// The bounds each grid currently holds for each entity, which are needed to update it.
+//      When pipelined, the frame alternates between two grids, so each has its own.
+std::array<std::vector<lightgrid::bounds>, 2> grid_bounds;
+
+// Entities found within the view by the grid, which are the only ones drawn
+std::vector<int> visible;
 
 std::mt19937 gen_rand;
 
+void printUsage();
+bool parseOptions(int argc, char** argv);
+
 lightgrid::bounds genBounds(int map_width, int map_height);
 
 bool isColliding(const entity& e1, const entity& e2);
 void resolveCollisionX(entity& e1, entity& e2);
 void resolveCollisionY(entity& e1, entity& e2);
 void resolveCollision(entity& e1, entity& e2);
-void resolveCollisions();
+void resolveCollisions(lightgrid::thread_pool& workers);
+void resolveWallCollision(entity& entity);
 
 void updatePositions(float delta_time);
+template<class Grid>
+void updateGrid(Grid& grid, std::vector<lightgrid::bounds>& held_bounds);
+int stalePadding(float delta_time);
+lightgrid::bounds padBounds(const lightgrid::bounds& bounds, int padding);
+template<class Grid>
+void findPairs(const Grid& grid, int padding, lightgrid::thread_pool& workers, std::vector<thread_scratch<Grid>>& scratch);
+void colourPairs();
+template<class Grid>
+void cullEntities(const Grid& grid, int padding, typename Grid::query_context& context);
 
 void createEntities(int num_entities);
-void prepareGrid();
+template<class Grid>
+void prepareGrid(Grid& grid, std::vector<lightgrid::bounds>& held_bounds);
 void drawRects();
 void pollEvents();
 
+template<int CellSize>
+void run();
+template<int... CellSizes>
+bool runWithCellSize(int cell_size, std::integer_sequence<int, CellSizes...>);
+
+void printTimes(int frame_count);
+
+template<typename F>
+void timePhase(double& phase_time, F&& phase);
+
+void printUsage() {
+    std::cout <<
+        "Usage: lightgrid_example [options]\n"
+        "  --entities N       Number of entities (default " << NUM_ENTITIES << ")\n"
+        "  --cell-size N      Grid cell size, one of 1 2 3 4 5 6 8 10 12 16 20 25 32 50 64 100 128 (default " << GRID_CELL_SIZE << ")\n"
+        "  --min-velocity V   Smallest entity velocity per axis (default " << MIN_ENTITY_VELOCITY << ")\n"
+        "  --max-velocity V   Largest entity velocity per axis (default " << MAX_ENTITY_VELOCITY << ")\n"
+        "  --frames N         Number of frames to run, 0 runs until the window is closed (default 0, or " << HEADLESS_FRAMES << " when headless)\n"
+        "  --timestep MS      Fixed milliseconds per frame, 0 uses real time (default 0, or " << HEADLESS_TIMESTEP << " when headless)\n"
+        "  --seed N           Random seed\n"
+        "  --threads N        Threads used for collision detection and resolution (default " << opts.num_threads << ")\n"
+        "  --headless         Run without SDL video or rendering\n"
+        "  --pipelined        Update the grid for the next frame while resolving the current one\n";
+}
+
+bool parseOptions(int argc, char** argv) {
+
+    for (int it{1}; it < argc; it++) {
+
+        const char* arg{argv[it]};
+        const bool has_value{it + 1 < argc};
+
+        if (std::strcmp(arg, "--headless") == 0) {
+            opts.headless = true;
+        } else if (std::strcmp(arg, "--pipelined") == 0) {
+            opts.pipelined = true;
+        } else if (std::strcmp(arg, "--help") == 0) {
+            return false;
+        } else if (has_value && std::strcmp(arg, "--entities") == 0) {
+            opts.num_entities = std::stoi(argv[++it]);
+        } else if (has_value && std::strcmp(arg, "--cell-size") == 0) {
+            opts.cell_size = std::stoi(argv[++it]);
+        } else if (has_value && std::strcmp(arg, "--min-velocity") == 0) {
+            opts.min_velocity = std::stof(argv[++it]);
+        } else if (has_value && std::strcmp(arg, "--max-velocity") == 0) {
+            opts.max_velocity = std::stof(argv[++it]);
+        } else if (has_value && std::strcmp(arg, "--frames") == 0) {
+            opts.num_frames = std::stoi(argv[++it]);
+        } else if (has_value && std::strcmp(arg, "--timestep") == 0) {
+            opts.timestep = std::stof(argv[++it]);
+        } else if (has_value && std::strcmp(arg, "--seed") == 0) {
+            opts.seed = std::stoul(argv[++it]);
+        } else if (has_value && std::strcmp(arg, "--threads") == 0) {
+            opts.num_threads = std::max(std::stoi(argv[++it]), 1);
+        } else {
+            std::cerr << "Unknown or incomplete option: " << arg << "\n";
+            return false;
+        }
+    }
+
+    if (opts.max_velocity < opts.min_velocity) {
+        std::cerr << "--max-velocity must not be less than --min-velocity\n";
+        return false;
+    }
+
+    if (opts.headless) {
+        opts.num_frames = opts.num_frames ? opts.num_frames : HEADLESS_FRAMES;
+        opts.timestep = opts.timestep > 0 ? opts.timestep : HEADLESS_TIMESTEP;
+    }
+
+    return true;
+}
+
 lightgrid::bounds genBounds(int map_width, int map_height) {
 
     int w,h;
@@ -231,69 +421,194 @@ void resolveCollision(entity& e1, entity& e2) {
     }
 }
 
-void resolveCollisions() {
+void resolveCollisions(lightgrid::thread_pool& workers) {
 
-    for (int it{0}; it < entities.size(); it++) {
+    const size_t num_batches{batch_offsets.size() - 1};
 
-        entity& entity{entities[it]};
-        
-        // The list being used for querying exists outside of this scope and
-        //      and is cleared as to avoid reallocation.
-        query.clear();
+    for (size_t batch{0}; batch < num_batches; batch++) {
+
+        const size_t batch_start{batch_offsets[batch]};
+        const size_t batch_size{batch_offsets[batch + 1] - batch_start};
+
+        if (batch_size == 0) {
+            continue;
+        }
+
+        auto resolve_pairs = [batch_start](size_t begin, size_t end, int thread) {
 
-        // The type of the results container must satisfy the lightgrid::insertable 
-        //      concept. After the query, the container will have had all the 
-        //      entities within the queried bounds inserted into it.
-        grid.query(entity.bounds, query);
+            for (size_t it{batch_start + begin}; it < batch_start + end; it++) {
 
-        // With the results in the "query" vector, it can be iterated over to find 
-        //      collisions among the other nearby entities.
-        for (auto& other_entity : query) {
+                entity& e1{entities[batches[it].first]};
+                entity& e2{entities[batches[it].second]};
 
-            if (it != other_entity && isColliding(entity, entities[other_entity])) {
-                resolveCollision(entity, entities[other_entity]);
+                // An earlier batch may have already pushed the entities apart
+                if (isColliding(e1, e2)) {
+                    resolveCollision(e1, e2);
+                }
             }
+        };
+
+        // The pairs without a colour may share entities, so they must be
+        //      resolved in order
+        if (batch == num_batches - 1) {
+            resolve_pairs(0, batch_size, 0);
+        } else {
+            runChunks(workers, batch_size, resolve_pairs);
         }
+    }
 
-        if (entity.real_x <= 0) {
-            entity.real_x = 0;
-            entity.velocity_x = -entity.velocity_x;
-        }
-        if (entity.real_y <= 0) {
-            entity.real_y = 0;
-            entity.velocity_y = -entity.velocity_y;
-        }
-        if (entity.real_x + entity.bounds.w > WINDOW_WIDTH) {
-            entity.real_x = WINDOW_WIDTH - entity.bounds.w;
-            entity.velocity_x = -entity.velocity_x;
-        }
-        if (entity.real_y + entity.bounds.h > WINDOW_HEIGHT) {
-            entity.real_y = WINDOW_HEIGHT - entity.bounds.h;
-            entity.velocity_y = -entity.velocity_y;
+    runChunks(workers, entities.size(), [](size_t begin, size_t end, int thread) {
+        for (size_t it{begin}; it < end; it++) {
+            resolveWallCollision(entities[it]);
         }
+    });
+}
+
+void resolveWallCollision(entity& entity) {
+
+    if (entity.real_x <= 0) {
+        entity.real_x = 0;
+        entity.velocity_x = -entity.velocity_x;
+    }
+    if (entity.real_y <= 0) {
+        entity.real_y = 0;
+        entity.velocity_y = -entity.velocity_y;
+    }
+    if (entity.real_x + entity.bounds.w > WINDOW_WIDTH) {
+        entity.real_x = WINDOW_WIDTH - entity.bounds.w;
+        entity.velocity_x = -entity.velocity_x;
+    }
+    if (entity.real_y + entity.bounds.h > WINDOW_HEIGHT) {
+        entity.real_y = WINDOW_HEIGHT - entity.bounds.h;
+        entity.velocity_y = -entity.velocity_y;
     }
 }
 
 void updatePositions(float delta_time) {
 
-    lightgrid::bounds old_bounds;
-
     for (int it{0}; it < entities.size(); it++) {
 
         entity& entity{entities[it]};
 
-        old_bounds = entity.bounds;
-
         entity.real_x += (delta_time/1000.0)*entity.velocity_x;
         entity.real_y += (delta_time/1000.0)*entity.velocity_y;
         entity.bounds.x = entity.real_x;
         entity.bounds.y = entity.real_y;
+    }
+}
+
+template<class Grid>
+void updateGrid(Grid& grid, std::vector<lightgrid::bounds>& held_bounds) {
+
+    for (int it{0}; it < entities.size(); it++) {
+
+        const entity& entity{entities[it]};
 
         // The previous bounds are needed when updating the position of an
         //      element in the grid, along with the index of the element node,
         //      within the grid. This is the only overhead that must be 
         //      considered when implementing the grid.
-        grid.update(entity.grid_element_node, old_bounds, entity.bounds);
+        grid.update(entity.grid_element_node, held_bounds[it], entity.bounds);
+        held_bounds[it] = entity.bounds;
+    }
+}
+
+int stalePadding(float delta_time) {
+
+    // When pipelined, the grid being queried holds the bounds from the previous
+    //      frame. Since then, an entity may have moved by its velocity, and may
+    //      have been pushed by up to its own size when resolving its collisions.
+    //      Padding the queried bounds by this much ensures nothing is missed.
+    const float max_speed{std::max(std::abs(opts.min_velocity), std::abs(opts.max_velocity))};
+
+    return std::ceil(max_speed*delta_time/1000.0f) + std::max(MAX_ENTITY_WIDTH, MAX_ENTITY_HEIGHT) + 1;
+}
+
+lightgrid::bounds padBounds(const lightgrid::bounds& bounds, int padding) {
+
+    const int x{std::max(bounds.x - padding, 0)};
+    const int y{std::max(bounds.y - padding, 0)};
+
+    return {x, y, bounds.x + bounds.w + padding - x, bounds.y + bounds.h + padding - y};
+}
+
+template<class Grid>
+void findPairs(const Grid& grid, int padding, lightgrid::thread_pool& workers, std::vector<thread_scratch<Grid>>& scratch) {
+
+    runChunks(workers, entities.size(), [&](size_t begin, size_t end, int thread) {
+
+        thread_scratch<Grid>& local{scratch[thread]};
+
+        // The lists being used for querying exist outside of this scope and
+        //      and are cleared as to avoid reallocation.
+        local.pairs.clear();
+
+        for (size_t it{begin}; it < end; it++) {
+
+            local.candidates.clear();
+
+            // The type of the results container must satisfy the lightgrid::insertable
+            //      concept. After the query, the container will have had all the
+            //      entities within the queried bounds inserted into it.
+            // Queries on a const grid need a context of their own, which is what
+            //      allows every thread to query the grid at the same time.
+            grid.query(padBounds(entities[it].bounds, padding), local.candidates, local.context);
+
+            // With the results in the candidates list, it can be iterated over to find
+            //      collisions among the other nearby entities. Each pair is only kept
+            //      once, by the entity with the lower index.
+            for (auto other_entity : local.candidates) {
+                if (static_cast<int>(it) < other_entity && isColliding(entities[it], entities[other_entity])) {
+                    local.pairs.push_back({static_cast<int>(it), other_entity});
+                }
+            }
+        }
+    });
+
+    // Each thread found the pairs of a contiguous range of entities, so joining
+    //      the lists in thread order gives the same pairs for any number of threads.
+    pairs.clear();
+
+    for (auto& local : scratch) {
+        pairs.insert(pairs.end(), local.pairs.begin(), local.pairs.end());
+    }
+}
+
+void colourPairs() {
+
+    // Each pair is given the lowest colour which neither of its entities has been
+    //      given yet, so that no entity appears twice in the pairs of one colour.
+    std::fill(used_colours.begin(), used_colours.end(), 0);
+    pair_colours.resize(pairs.size());
+
+    std::array<size_t, NUM_COLOURS + 2> colour_offsets{};
+
+    for (size_t it{0}; it < pairs.size(); it++) {
+
+        uint64_t& first_colours{used_colours[pairs[it].first]};
+        uint64_t& second_colours{used_colours[pairs[it].second]};
+
+        const uint64_t free_colours{~(first_colours | second_colours)};
+        const int colour{std::countr_zero(free_colours)}; // NUM_COLOURS if none are free
+
+        if (colour < NUM_COLOURS) {
+            first_colours |= uint64_t{1} << colour;
+            second_colours |= uint64_t{1} << colour;
+        }
+
+        pair_colours[it] = colour;
+        colour_offsets[colour + 1]++;
+    }
+
+    for (size_t colour{1}; colour < colour_offsets.size(); colour++) {
+        colour_offsets[colour] += colour_offsets[colour - 1];
+    }
+
+    batch_offsets.assign(colour_offsets.begin(), colour_offsets.end());
+    batches.resize(pairs.size());
+
+    for (size_t it{0}; it < pairs.size(); it++) {
+        batches[colour_offsets[pair_colours[it]]++] = pairs[it];
     }
 }
 
@@ -328,18 +643,20 @@ void createEntities(int num_entities) {
         start_y = 0;
     }
 
-    int entity_count{0};
     uint8_t lowest_color{100};
 
     for (int entity_count{0}; entity_count < num_entities && entity_count < max_num_entities; entity_count++) {
 
         lightgrid::bounds new_bounds{genBounds(WINDOW_WIDTH, WINDOW_HEIGHT)};
 
-        float max_velocity{MAX_ENTITY_VELOCITY};
-        float min_velocity{MIN_ENTITY_VELOCITY};
+        float max_velocity{opts.max_velocity};
+        float min_velocity{opts.min_velocity};
+
+        // Equal velocities would leave nothing to choose between
+        uint_fast32_t velocity_range{std::max<uint_fast32_t>((uint_fast32_t)(max_velocity*100-min_velocity*100), 1)};
 
-        float velocity_x{(gen_rand()%((uint_fast32_t)(max_velocity*100-min_velocity*100))/100.0f+min_velocity)};
-        float velocity_y{(gen_rand()%((uint_fast32_t)(max_velocity*100-min_velocity*100))/100.0f+min_velocity)};
+        float velocity_x{(gen_rand()%velocity_range)/100.0f+min_velocity};
+        float velocity_y{(gen_rand()%velocity_range)/100.0f+min_velocity};
         
         int curr_x{(entity_count%width + start_x)*(MAX_ENTITY_WIDTH+padding)};
         int curr_y{(entity_count/width + start_y)*(MAX_ENTITY_HEIGHT+padding)};
@@ -363,24 +680,43 @@ void createEntities(int num_entities) {
     }
 }
 
-void prepareGrid() {
+template<class Grid>
+void cullEntities(const Grid& grid, int padding, typename Grid::query_context& context) {
+
+    visible.clear();
+    grid.query(padBounds({0, 0, WINDOW_WIDTH, WINDOW_HEIGHT}, padding), visible, context);
+}
+
+template<class Grid>
+void prepareGrid(Grid& grid, std::vector<lightgrid::bounds>& held_bounds) {
     
-    // grid.init(WINDOW_WIDTH, WINDOW_HEIGHT, GRID_CELL_SIZE);
     grid.reserve(entities.size());
-    query.reserve(entities.size());
+    pairs.reserve(entities.size());
+    used_colours.resize(entities.size());
+    visible.reserve(entities.size());
 
+    // When pipelined, both grids are filled in the same order, so an entity is
+    //      given the same element node in each.
     for (int it{0}; it < entities.size(); it++) {
         // When inserting into the grid, the index of the internal element node must be stored somewhere.
         entities[it].grid_element_node= grid.insert(it, entities[it].bounds);
     }
+
+    held_bounds.resize(entities.size());
+
+    for (int it{0}; it < entities.size(); it++) {
+        held_bounds[it] = entities[it].bounds;
+    }
 }
 
 void drawRects() {
 
-    for (auto entity : entities) {
+    for (auto it : visible) {
+
+        const entity& entity{entities[it]};
 
         SDL_SetRenderDrawColor(renderer, entity.color.r, entity.color.g, entity.color.b, 255);
-        SDL_RenderFillRect(renderer, reinterpret_cast<SDL_Rect*>(&(entity.bounds)));
+        SDL_RenderFillRect(renderer, reinterpret_cast<const SDL_Rect*>(&(entity.bounds)));
     }
 }
 
@@ -404,56 +740,271 @@ void pollEvents() {
     }
 }
 
-int main(int argc, char **argv) {
+void runChunks(lightgrid::thread_pool& workers, size_t count, const chunk_job& job) {
+
+    const size_t num_chunks{workers.size()};
+
+    // Not worth waking the other threads for
+    if (num_chunks == 1 || count < num_chunks) {
+        job(0, count, 0);
+        return;
+    }
+
+    // Each chunk is a task of its own, so that its index is never shared and can
+    //      pick the scratch, even if the chunk is stolen by another thread
+    workers.run(num_chunks, [&](size_t chunk) {
+        job(count*chunk/num_chunks, count*(chunk + 1)/num_chunks, chunk);
+    });
+}
+
+stage_thread::stage_thread() : thread{&stage_thread::work, this} {}
+
+stage_thread::~stage_thread() {
+
+    {
+        std::lock_guard lock{this->mutex};
+        this->stopping = true;
+    }
+
+    this->job_ready.notify_one();
+    this->thread.join();
+}
+
+void stage_thread::start(std::function<void()> job) {
+
+    {
+        std::lock_guard lock{this->mutex};
+        this->job = std::move(job);
+        this->busy = true;
+    }
 
-    SDL_Init(SDL_INIT_TIMER | SDL_INIT_VIDEO);
-    SDL_CreateWindowAndRenderer(WINDOW_WIDTH, WINDOW_HEIGHT, 0, &window, &renderer);
+    this->job_ready.notify_one();
+}
+
+void stage_thread::wait() {
+
+    std::unique_lock lock{this->mutex};
+    this->job_done.wait(lock, [this] { return !this->busy; });
+}
+
+void stage_thread::work() {
+
+    while (true) {
+
+        {
+            std::unique_lock lock{this->mutex};
+            this->job_ready.wait(lock, [this] { return this->stopping || this->busy; });
+
+            if (this->stopping) {
+                return;
+            }
+        }
+
+        this->job();
+
+        {
+            std::lock_guard lock{this->mutex};
+            this->busy = false;
+        }
+
+        this->job_done.notify_one();
+    }
+}
+
+template<typename F>
+void timePhase(double& phase_time, F&& phase) {
+
+    auto start{std::chrono::steady_clock::now()};
+    phase();
+    phase_time += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
     
-    createEntities(NUM_ENTITIES);
-    prepareGrid();
+void printTimes(int frame_count) {
+
+    std::cout << "\n\nFrames: " << frame_count << ", entities: " << entities.size() << ", cell size: " << opts.cell_size << ", threads: " << opts.num_threads
+        << (opts.pipelined ? ", pipelined" : "") << "\n";
+    std::cout << std::left << std::setw(12) << "phase" << std::right << std::setw(14) << "total ms" << std::setw(14) << "ms/frame" << "\n";
+
+    std::vector<std::pair<const char*, double>> phases{
+        {"update", times.update}, {"grid update", times.grid_update}, {"broadphase", times.broadphase},
+        {"colour", times.colour}, {"resolve", times.resolve}, {"cull", times.cull}
+    };
+
+    if (opts.pipelined) {
+        phases.emplace_back("wait", times.wait);
+    }
+
+    if (!opts.headless) {
+        phases.emplace_back("render", times.render);
+    }
+
+    phases.emplace_back("frame", times.frame);
+
+    for (auto [name, time] : phases) {
+        std::cout << std::left << std::setw(12) << name << std::right << std::fixed << std::setprecision(3)
+            << std::setw(14) << time << std::setw(14) << (frame_count ? time/frame_count : 0.0) << "\n";
+    }
+
+    if (opts.pipelined) {
+
+        // Whatever part of the grid update the main thread didn't wait on ran
+        //      alongside the other stages
+        const double overlapped{std::max(times.grid_update - times.wait, 0.0)};
+
+        std::cout << "\nGrid update overlapped: " << overlapped << " ms of " << times.grid_update << " ms ("
+            << std::setprecision(1) << (times.grid_update > 0 ? 100.0*overlapped/times.grid_update : 0.0) << "%)\n";
+    }
+}
+
+template<int CellSize>
+void run() {
+
+    // While the grid's performance when querying will not suffer by holding the
+    //      entities directly, there may be a performace penalty during insertion
+    //      and retrieval as a copy of the type will be stored in the grid, and
+    //      this will be copied.
+    // It is slightly prefered to insert pointers or indicies into other lists
+    //      than it is to store an instance of that type.
+    using grid_type = lightgrid::grid<int, CellSize>;
+
+    // When pipelined, the grid for the next frame is updated while the current
+    //      frame's collisions are resolved against the other grid. Otherwise,
+    //      only the first grid is used.
+    std::array<grid_type, 2> grids;
+    int front{0};
+
+    lightgrid::thread_pool workers{static_cast<size_t>(opts.num_threads)};
+    std::vector<thread_scratch<grid_type>> scratch(workers.size());
+    stage_thread grid_stage;
+
+    createEntities(opts.num_entities);
+    prepareGrid(grids[0], grid_bounds[0]);
+
+    if (opts.pipelined) {
+        prepareGrid(grids[1], grid_bounds[1]);
+    }
     
     std::cout << "Number of entities: " << entities.size() << "\n";
 
-    uint64_t last_frame{SDL_GetTicks64()};
-    uint64_t current_frame{SDL_GetTicks64()};
-    uint64_t delta_time{0};
+    auto last_frame{std::chrono::steady_clock::now()};
+    auto current_frame{std::chrono::steady_clock::now()};
+    float delta_time{0};
 
     int frame_count{0};
-    uint64_t interval_time{0};
+    int interval_frame_count{0};
+    float interval_time{0};
 
-    while (!quit) {
+    while (!quit && (opts.num_frames == 0 || frame_count < opts.num_frames)) {
 
-        pollEvents();
+        current_frame = std::chrono::steady_clock::now();
+
+        if (opts.timestep > 0) {
+            delta_time = opts.timestep;
+        } else {
+            delta_time = std::chrono::duration<float, std::milli>(current_frame - last_frame).count();
+        }
 
-        current_frame = SDL_GetTicks64();
-        delta_time = current_frame - last_frame;
         last_frame = current_frame;
 
-        SDL_SetRenderDrawColor(renderer, 40, 35, 30, 0);
-        SDL_RenderClear(renderer);
+        if (!opts.headless) {
+            pollEvents();
         
-        updatePositions(delta_time);
-        resolveCollisions();
+            SDL_SetRenderDrawColor(renderer, 40, 35, 30, 0);
+            SDL_RenderClear(renderer);
+        }
 
-        #if !(MEASURE_MEMORY)
-            drawRects();
-        #endif
+        const auto frame_start{std::chrono::steady_clock::now()};
 
-        SDL_RenderPresent(renderer);
+        timePhase(times.update, [&] { updatePositions(delta_time); });
+
+        const int back{1 - front};
+        int padding{0};
+
+        if (opts.pipelined) {
+
+            // The new positions are only read by the grid update, while the
+            //      resolution only changes the real positions and velocities,
+            //      so the two can safely run at the same time.
+            grid_stage.start([&grids, back] {
+                timePhase(times.grid_update, [&] { updateGrid(grids[back], grid_bounds[back]); });
+            });
+
+            padding = stalePadding(delta_time);
+
+        } else {
+            timePhase(times.grid_update, [&] { updateGrid(grids[front], grid_bounds[front]); });
+        }
+
+        const grid_type& grid{grids[front]};
+
+        timePhase(times.broadphase, [&] { findPairs(grid, padding, workers, scratch); });
+        timePhase(times.colour, [&] { colourPairs(); });
+        timePhase(times.resolve, [&] { resolveCollisions(workers); });
+        timePhase(times.cull, [&] { cullEntities(grid, padding, scratch[0].context); });
+
+        if (opts.pipelined) {
+            timePhase(times.wait, [&] { grid_stage.wait(); });
+            front = back;
+        }
+
+        if (!opts.headless) {
+            timePhase(times.render, [&] {
+                #if !(MEASURE_MEMORY)
+                    drawRects();
+                #endif
+
+                SDL_RenderPresent(renderer);
+            });
+        }
+
+        times.frame += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start).count();
 
         frame_count++;
+        interval_frame_count++;
         interval_time += delta_time;
         
-        if (interval_time >= 1000) {
-            std::cout << "\r" << std::fixed << std::setprecision(2) << "FPS: " << std::setw(10) << (frame_count/(float)interval_time)*1000.0f;
-            frame_count = 0;
+        if (!opts.headless && interval_time >= 1000) {
+            std::cout << "\r" << std::fixed << std::setprecision(2) << "FPS: " << std::setw(10) << (interval_frame_count/interval_time)*1000.0f;
+            interval_frame_count = 0;
             interval_time = 0;
         }
     }
 
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
-    SDL_Quit();
+    printTimes(frame_count);
+}
+
+template<int... CellSizes>
+bool runWithCellSize(int cell_size, std::integer_sequence<int, CellSizes...>) {
+    return ((cell_size == CellSizes ? (run<CellSizes>(), true) : false) || ...);
+}
+
+int main(int argc, char **argv) {
+
+    if (!parseOptions(argc, argv)) {
+        printUsage();
+        return 1;
+    }
+
+    gen_rand.seed(opts.seed);
+
+    if (!opts.headless) {
+        SDL_Init(SDL_INIT_TIMER | SDL_INIT_VIDEO);
+        SDL_CreateWindowAndRenderer(WINDOW_WIDTH, WINDOW_HEIGHT, 0, &window, &renderer);
+    }
+
+    const bool supported{runWithCellSize(opts.cell_size, supported_cell_sizes{})};
+
+    if (!opts.headless) {
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+    }
+
+    if (!supported) {
+        std::cerr << "Unsupported cell size: " << opts.cell_size << "\n";
+        printUsage();
+        return 1;
+    }
 
     return 0;
-}
\ No newline at end of file
+}
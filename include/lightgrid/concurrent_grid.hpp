@@ -0,0 +1,483 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+
+#include "grid.hpp"
+
+namespace lightgrid {
+
+    /**
+    * @brief Grid which may be changed and queried from several threads at once.
+    *   The cells are split into 64 stripes, each a contiguous range of the z-order curve with its own lock, so that
+    *   writers in different areas rarely wait on each other. An operation only locks the stripes of the cells it touches,
+    *   always in ascending order so that no two operations can deadlock. Queries take the stripes as readers and dedupe
+    *   by reference point, so they need no scratch.
+    *   Each writing thread allocates from its own node_pool rather than a shared free list. Nodes are allocated in chunks
+    *   which never move, so no operation has to wait for the node lists to grow.
+    */
+    template<class T, int CellSize, size_t ZBitWidth=16u>
+    requires (ZBitWidth <= 32u)
+    class concurrent_grid {
+    public:
+        // Nodes freed through a pool are reused by the same pool. A pool must only be used by one thread at a time
+        class node_pool {
+        public:
+            node_pool() = default;
+
+        private:
+            friend class concurrent_grid;
+
+            int free_cell_nodes{-1};
+            int free_elements{-1};
+        };
+
+        concurrent_grid();
+
+        node_pool make_pool() const;
+
+        int insert(node_pool& pool, const T& element, const bounds& bounds);
+        int insert(node_pool& pool, const T& element, const cell_bounds& bounds);
+        void remove(node_pool& pool, int element_node, const bounds& bounds);
+        void remove(node_pool& pool, int element_node, const cell_bounds& bounds);
+        void update(node_pool& pool, int element_node, const bounds& old_bounds, const bounds& new_bounds);
+        void update(node_pool& pool, int element_node, const cell_bounds& old_bounds, const cell_bounds& new_bounds);
+
+        template<typename R>
+        requires insertable<R, T>
+        R& query(const bounds& bounds, R& results) const;
+        template<typename R>
+        requires insertable<R, T>
+        R& query(const cell_bounds& bounds, R& results) const;
+
+        void visit(const bounds& bounds, void(*VisitFunc)(T, void*), void* user_data) const;
+        void visit(const cell_bounds& bounds, void(*VisitFunc)(T, void*), void* user_data) const;
+
+        cell_bounds get_cell_bounds(const bounds& bounds) const;
+
+    private:
+        static constexpr uint64_t wrapping_bit_mask{(uint64_t{1} << ZBitWidth) - 1};
+
+        static constexpr int stripe_bits{ZBitWidth < 6 ? static_cast<int>(ZBitWidth) : 6};
+        static constexpr int num_stripes{1 << stripe_bits};
+
+        static constexpr int chunk_bits{12};
+        static constexpr int chunk_size{1 << chunk_bits};
+        static constexpr int max_chunks{1 << 16};
+        static constexpr int block_bits{8};
+        static constexpr int block_size{1 << block_bits};
+
+        struct node {
+            int element=-1;
+            int next=-1; // Either the next node in the cell or in the pool's free list
+        };
+
+        struct element_slot {
+            T element;
+            cell_bounds bounds;
+            int next_free=-1;
+        };
+
+        struct alignas(64) stripe {
+            mutable std::shared_mutex mutex;
+        };
+
+        // Lists of fixed-size chunks, which are only ever appended to. A chunk is always allocated by the thread which
+        //      first uses its nodes, before they are linked into any cell under a stripe lock.
+        //      The table of chunks is split into blocks, each allocated along with its first chunk, so that an empty list
+        //      only holds a pointer per block rather than one per chunk
+        template<typename V>
+        struct chunked_list {
+            std::array<std::atomic<std::unique_ptr<V[]>*>, max_chunks/block_size> blocks{};
+            std::atomic<int> num_chunks{0};
+
+            chunked_list() = default;
+            ~chunked_list();
+
+            V& operator[](int index);
+            const V& operator[](int index) const;
+            // Allocates a whole chunk, returning the index of its first entry
+            int allocate_chunk();
+        };
+
+        uint64_t stripe_mask(const cell_bounds& bounds) const;
+        void lock(uint64_t stripes) const;
+        void unlock(uint64_t stripes) const;
+        void lock_shared(uint64_t stripes) const;
+        void unlock_shared(uint64_t stripes) const;
+
+        int allocate_cell_node(node_pool& pool);
+        int allocate_element(node_pool& pool);
+
+        void cell_insert(node_pool& pool, int cell, int element_node);
+        void cell_remove(node_pool& pool, int cell, int element_node);
+
+        bool is_reference_cell(int element_node, const cell_bounds& bounds, int x, int y) const;
+
+        inline uint64_t z_order(uint32_t x, uint32_t y) const;
+
+        std::vector<int> cell_heads{std::vector<int>(wrapping_bit_mask + 1, -1)};
+        chunked_list<node> cell_nodes;
+        chunked_list<element_slot> elements;
+
+        std::array<stripe, num_stripes> stripes;
+    };
+
+    template<class T, int CellSize, size_t ZBitWidth>
+    requires (ZBitWidth <= 32u)
+    template<typename V>
+    concurrent_grid<T, CellSize, ZBitWidth>::chunked_list<V>::~chunked_list() {
+        for (auto& block : this->blocks) {
+            delete[] block.load(std::memory_order_relaxed);
+        }
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth>
+    requires (ZBitWidth <= 32u)
+    template<typename V>
+    V& concurrent_grid<T, CellSize, ZBitWidth>::chunked_list<V>::operator[](int index) {
+        const int chunk{index >> chunk_bits};
+        return this->blocks[chunk >> block_bits].load(std::memory_order_acquire)[chunk & (block_size - 1)][index & (chunk_size - 1)];
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth>
+    requires (ZBitWidth <= 32u)
+    template<typename V>
+    const V& concurrent_grid<T, CellSize, ZBitWidth>::chunked_list<V>::operator[](int index) const {
+        const int chunk{index >> chunk_bits};
+        return this->blocks[chunk >> block_bits].load(std::memory_order_acquire)[chunk & (block_size - 1)][index & (chunk_size - 1)];
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth>
+    requires (ZBitWidth <= 32u)
+    template<typename V>
+    int concurrent_grid<T, CellSize, ZBitWidth>::chunked_list<V>::allocate_chunk() {
+        const int chunk{this->num_chunks.fetch_add(1, std::memory_order_relaxed)};
+        assert(chunk < max_chunks && "Concurrent grid ran out of chunks");
+
+        std::atomic<std::unique_ptr<V[]>*>& block{this->blocks[chunk >> block_bits]};
+        std::unique_ptr<V[]>* chunks{block.load(std::memory_order_acquire)};
+
+        // Whichever thread first needs the block allocates it, and any other thread racing it uses that one instead
+        if (chunks == nullptr) {
+            std::unique_ptr<V[]>* new_chunks{new std::unique_ptr<V[]>[block_size]};
+
+            if (block.compare_exchange_strong(chunks, new_chunks, std::memory_order_acq_rel)) {
+                chunks = new_chunks;
+            } else {
+                delete[] new_chunks;
+            }
+        }
+
+        chunks[chunk & (block_size - 1)] = std::make_unique<V[]>(chunk_size);
+
+        return chunk << chunk_bits;
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth>
+    requires (ZBitWidth <= 32u)
+    concurrent_grid<T, CellSize, ZBitWidth>::concurrent_grid() {}
+
+    template<class T, int CellSize, size_t ZBitWidth>
+    requires (ZBitWidth <= 32u)
+    typename concurrent_grid<T, CellSize, ZBitWidth>::node_pool concurrent_grid<T, CellSize, ZBitWidth>::make_pool() const {
+        return node_pool{};
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth>
+    requires (ZBitWidth <= 32u)
+    int concurrent_grid<T, CellSize, ZBitWidth>::insert(node_pool& pool, const T& element, const bounds& bounds) {
+        return this->insert(pool, element, this->get_cell_bounds(bounds));
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth>
+    requires (ZBitWidth <= 32u)
+    int concurrent_grid<T, CellSize, ZBitWidth>::insert(node_pool& pool, const T& element, const cell_bounds& bounds) {
+        // The element isn't in any cell yet, so no other thread can see it
+        const int new_element_node{this->allocate_element(pool)};
+        this->elements[new_element_node].element = element;
+        this->elements[new_element_node].bounds = bounds;
+
+        const uint64_t stripes{this->stripe_mask(bounds)};
+        this->lock(stripes);
+
+        for (int yy{bounds.y_start}; yy <= bounds.y_end; yy++) {
+            for (int xx{bounds.x_start}; xx <= bounds.x_end; xx++) {
+                this->cell_insert(pool, this->z_order(xx, yy), new_element_node);
+            }
+        }
+
+        this->unlock(stripes);
+
+        return new_element_node;
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth>
+    requires (ZBitWidth <= 32u)
+    void concurrent_grid<T, CellSize, ZBitWidth>::remove(node_pool& pool, int element_node, const bounds& bounds) {
+        this->remove(pool, element_node, this->get_cell_bounds(bounds));
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth>
+    requires (ZBitWidth <= 32u)
+    void concurrent_grid<T, CellSize, ZBitWidth>::remove(node_pool& pool, int element_node, const cell_bounds& bounds) {
+        const uint64_t stripes{this->stripe_mask(bounds)};
+        this->lock(stripes);
+
+        for (int yy{bounds.y_start}; yy <= bounds.y_end; yy++) {
+            for (int xx{bounds.x_start}; xx <= bounds.x_end; xx++) {
+                this->cell_remove(pool, this->z_order(xx, yy), element_node);
+            }
+        }
+
+        this->unlock(stripes);
+
+        // Once out of every cell, the element can't be seen by other threads
+        this->elements[element_node].next_free = pool.free_elements;
+        pool.free_elements = element_node;
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth>
+    requires (ZBitWidth <= 32u)
+    void concurrent_grid<T, CellSize, ZBitWidth>::update(node_pool& pool, int element_node, const bounds& old_bounds, const bounds& new_bounds) {
+        this->update(pool, element_node, this->get_cell_bounds(old_bounds), this->get_cell_bounds(new_bounds));
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth>
+    requires (ZBitWidth <= 32u)
+    void concurrent_grid<T, CellSize, ZBitWidth>::update(node_pool& pool, int element_node, const cell_bounds& old_bounds, const cell_bounds& new_bounds) {
+        // Only the stripes of the old and new cells are taken, together, so that readers never see the element half moved
+        const uint64_t stripes{this->stripe_mask(old_bounds) | this->stripe_mask(new_bounds)};
+        this->lock(stripes);
+
+        for (int yy{old_bounds.y_start}; yy <= old_bounds.y_end; yy++) {
+            for (int xx{old_bounds.x_start}; xx <= old_bounds.x_end; xx++) {
+                this->cell_remove(pool, this->z_order(xx, yy), element_node);
+            }
+        }
+
+        for (int yy{new_bounds.y_start}; yy <= new_bounds.y_end; yy++) {
+            for (int xx{new_bounds.x_start}; xx <= new_bounds.x_end; xx++) {
+                this->cell_insert(pool, this->z_order(xx, yy), element_node);
+            }
+        }
+
+        // Readers only look at the bounds of elements in the cells they hold, which are all held here
+        this->elements[element_node].bounds = new_bounds;
+
+        this->unlock(stripes);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth>
+    requires (ZBitWidth <= 32u)
+    template<typename R>
+    requires insertable<R, T>
+    R& concurrent_grid<T, CellSize, ZBitWidth>::query(const bounds& bounds, R& results) const {
+        return this->query(this->get_cell_bounds(bounds), results);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth>
+    requires (ZBitWidth <= 32u)
+    template<typename R>
+    requires insertable<R, T>
+    R& concurrent_grid<T, CellSize, ZBitWidth>::query(const cell_bounds& bounds, R& results) const {
+        const uint64_t stripes{this->stripe_mask(bounds)};
+        this->lock_shared(stripes);
+
+        for (int yy{bounds.y_start}; yy <= bounds.y_end; yy++) {
+            for (int xx{bounds.x_start}; xx <= bounds.x_end; xx++) {
+                for (int current_node{this->cell_heads[this->z_order(xx, yy)]}; current_node != -1; current_node = this->cell_nodes[current_node].next) {
+                    const int current_element{this->cell_nodes[current_node].element};
+
+                    if (this->is_reference_cell(current_element, bounds, xx, yy)) {
+                        results.insert(results.end(), this->elements[current_element].element);
+                    }
+                }
+            }
+        }
+
+        this->unlock_shared(stripes);
+
+        return results;
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth>
+    requires (ZBitWidth <= 32u)
+    void concurrent_grid<T, CellSize, ZBitWidth>::visit(const bounds& bounds, void(*VisitFunc)(T, void*), void* user_data) const {
+        this->visit(this->get_cell_bounds(bounds), VisitFunc, user_data);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth>
+    requires (ZBitWidth <= 32u)
+    void concurrent_grid<T, CellSize, ZBitWidth>::visit(const cell_bounds& bounds, void(*VisitFunc)(T, void*), void* user_data) const {
+        const uint64_t stripes{this->stripe_mask(bounds)};
+        this->lock_shared(stripes);
+
+        for (int yy{bounds.y_start}; yy <= bounds.y_end; yy++) {
+            for (int xx{bounds.x_start}; xx <= bounds.x_end; xx++) {
+                for (int current_node{this->cell_heads[this->z_order(xx, yy)]}; current_node != -1; current_node = this->cell_nodes[current_node].next) {
+                    const int current_element{this->cell_nodes[current_node].element};
+
+                    if (this->is_reference_cell(current_element, bounds, xx, yy)) {
+                        VisitFunc(this->elements[current_element].element, user_data);
+                    }
+                }
+            }
+        }
+
+        this->unlock_shared(stripes);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth>
+    requires (ZBitWidth <= 32u)
+    cell_bounds concurrent_grid<T, CellSize, ZBitWidth>::get_cell_bounds(const bounds& bounds) const {
+        return detail::get_cell_bounds<CellSize>(bounds);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth>
+    requires (ZBitWidth <= 32u)
+    uint64_t concurrent_grid<T, CellSize, ZBitWidth>::stripe_mask(const cell_bounds& bounds) const {
+        uint64_t stripes{0};
+
+        // Each stripe is a contiguous range of the z-order curve, found from the top bits of the z-order
+        for (int yy{bounds.y_start}; yy <= bounds.y_end; yy++) {
+            for (int xx{bounds.x_start}; xx <= bounds.x_end; xx++) {
+                stripes |= uint64_t{1} << (this->z_order(xx, yy) >> (ZBitWidth - stripe_bits));
+            }
+        }
+
+        return stripes;
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth>
+    requires (ZBitWidth <= 32u)
+    void concurrent_grid<T, CellSize, ZBitWidth>::lock(uint64_t stripes) const {
+        // Always locking in ascending order means two threads can never each hold a stripe the other is waiting on
+        for (uint64_t remaining{stripes}; remaining != 0; remaining &= remaining - 1) {
+            this->stripes[std::countr_zero(remaining)].mutex.lock();
+        }
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth>
+    requires (ZBitWidth <= 32u)
+    void concurrent_grid<T, CellSize, ZBitWidth>::unlock(uint64_t stripes) const {
+        for (uint64_t remaining{stripes}; remaining != 0; remaining &= remaining - 1) {
+            this->stripes[std::countr_zero(remaining)].mutex.unlock();
+        }
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth>
+    requires (ZBitWidth <= 32u)
+    void concurrent_grid<T, CellSize, ZBitWidth>::lock_shared(uint64_t stripes) const {
+        for (uint64_t remaining{stripes}; remaining != 0; remaining &= remaining - 1) {
+            this->stripes[std::countr_zero(remaining)].mutex.lock_shared();
+        }
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth>
+    requires (ZBitWidth <= 32u)
+    void concurrent_grid<T, CellSize, ZBitWidth>::unlock_shared(uint64_t stripes) const {
+        for (uint64_t remaining{stripes}; remaining != 0; remaining &= remaining - 1) {
+            this->stripes[std::countr_zero(remaining)].mutex.unlock_shared();
+        }
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth>
+    requires (ZBitWidth <= 32u)
+    int concurrent_grid<T, CellSize, ZBitWidth>::allocate_cell_node(node_pool& pool) {
+        if (pool.free_cell_nodes == -1) {
+
+            // Take a whole chunk, linking it into the pool's free list
+            const int first{this->cell_nodes.allocate_chunk()};
+
+            for (int it{first}; it < first + chunk_size - 1; it++) {
+                this->cell_nodes[it].next = it + 1;
+            }
+
+            this->cell_nodes[first + chunk_size - 1].next = -1;
+            pool.free_cell_nodes = first;
+        }
+
+        const int new_node{pool.free_cell_nodes};
+        pool.free_cell_nodes = this->cell_nodes[new_node].next;
+
+        return new_node;
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth>
+    requires (ZBitWidth <= 32u)
+    int concurrent_grid<T, CellSize, ZBitWidth>::allocate_element(node_pool& pool) {
+        if (pool.free_elements == -1) {
+            const int first{this->elements.allocate_chunk()};
+
+            for (int it{first}; it < first + chunk_size - 1; it++) {
+                this->elements[it].next_free = it + 1;
+            }
+
+            this->elements[first + chunk_size - 1].next_free = -1;
+            pool.free_elements = first;
+        }
+
+        const int new_element{pool.free_elements};
+        pool.free_elements = this->elements[new_element].next_free;
+
+        return new_element;
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth>
+    requires (ZBitWidth <= 32u)
+    inline void concurrent_grid<T, CellSize, ZBitWidth>::cell_insert(node_pool& pool, int cell, int element_node) {
+        const int new_node{this->allocate_cell_node(pool)};
+
+        this->cell_nodes[new_node].element = element_node;
+        this->cell_nodes[new_node].next = this->cell_heads[cell];
+        this->cell_heads[cell] = new_node;
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth>
+    requires (ZBitWidth <= 32u)
+    inline void concurrent_grid<T, CellSize, ZBitWidth>::cell_remove(node_pool& pool, int cell, int element_node) {
+        int previous_node{-1};
+        int current_node{this->cell_heads[cell]};
+
+        while (current_node != -1 && this->cell_nodes[current_node].element != element_node) {
+            previous_node = current_node;
+            current_node = this->cell_nodes[current_node].next;
+        }
+
+        if (current_node == -1) {
+            return;
+        }
+
+        if (previous_node == -1) {
+            this->cell_heads[cell] = this->cell_nodes[current_node].next;
+        } else {
+            this->cell_nodes[previous_node].next = this->cell_nodes[current_node].next;
+        }
+
+        // The node goes to the pool of whichever thread removed it
+        this->cell_nodes[current_node].next = pool.free_cell_nodes;
+        pool.free_cell_nodes = current_node;
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth>
+    requires (ZBitWidth <= 32u)
+    inline bool concurrent_grid<T, CellSize, ZBitWidth>::is_reference_cell(int element_node, const cell_bounds& bounds, int x, int y) const {
+        const cell_bounds& stored{this->elements[element_node].bounds};
+        return x == std::max(bounds.x_start, stored.x_start) && y == std::max(bounds.y_start, stored.y_start);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth>
+    requires (ZBitWidth <= 32u)
+    inline uint64_t concurrent_grid<T, CellSize, ZBitWidth>::z_order(uint32_t x, uint32_t y) const {
+        return detail::z_order(x, y, wrapping_bit_mask);
+    }
+}
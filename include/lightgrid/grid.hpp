@@ -1,12 +1,38 @@
 #pragma once
 
 #include <cassert>
+#include <cstdint>
 #include <vector>
 #include <array>
 #include <algorithm>
 #include <span>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <cmath>
+#include <climits>
+#include <coroutine>
+#include <exception>
+#include <iterator>
+#include <concepts>
+#include <functional>
+#include <memory>
+
+// Defining LIGHTGRID_LATENCY_HISTOGRAMS times each insert, update, remove, query and visit into a histogram
+//      per operation. Timing uses std::chrono::steady_clock in nanoseconds, or the time-stamp counter in cycles on
+//      x86-64 if LIGHTGRID_LATENCY_RDTSC is also defined. Both must be defined the same way in every translation unit
+#ifdef LIGHTGRID_LATENCY_HISTOGRAMS
+    #include <atomic>
+    #include <chrono>
+    #if defined(LIGHTGRID_LATENCY_RDTSC) && defined(__x86_64__)
+        #include <x86intrin.h>
+    #endif
+#endif
 
-#if defined(__BMI2__) && (defined(__GNUC__) || defined(__llvm__)) && defined(__x86_64__)
+// Defining LIGHTGRID_EVENT_COUNTERS counts events inside the cell list operations, which can be read as a snapshot
+//      through grid::counters(). It must be defined the same way in every translation unit
+
+#if (defined(__BMI2__) || defined(__AVX2__) || defined(__AVX512F__)) && (defined(__GNUC__) || defined(__llvm__)) && defined(__x86_64__)
     #include <immintrin.h>
 #endif
 
@@ -16,6 +42,13 @@ namespace lightgrid {
         {c.insert(c.end(), std::forward<T>(t))};
     };
 
+    // Runs task(index) for every index below the given count, possibly in parallel, returning once all have finished
+    template<typename P>
+    concept task_pool = requires(P& pool, size_t num_tasks, const std::function<void(size_t)>& task) {
+        {pool.size()} -> std::convertible_to<size_t>;
+        {pool.run(num_tasks, task)};
+    };
+
     struct bounds {
         int x,y,w,h;
     };
@@ -24,52 +57,489 @@ namespace lightgrid {
         int x_start, x_end, y_start, y_end;
     };
 
+    // Mapping from bounds to cells and from cells to their z-order, shared by grid and concurrent_grid
+    namespace detail {
+        template<int CellSize>
+        cell_bounds get_cell_bounds(const bounds& bounds);
+
+        uint64_t interleave_with_zeros(uint32_t input);
+        uint64_t interleave(uint32_t x, uint32_t y);
+        // Cells beyond the mask wrap around onto the cells of the grid
+        uint64_t z_order(uint32_t x, uint32_t y, uint64_t wrapping_bit_mask);
+    }
+
+    enum class ordering {
+        unordered, // Results follow the order of the cell lists, which depends on the history of the grid
+        by_element_node // Results are sorted by element node, so the same grid state always gives the same order
+    };
+
+    enum class dedupe {
+        visited_set, // Elements are marked as they are seen, which works for any element but needs per-element scratch
+        reference_point // Elements are only reported from the first cell they share with the bounds, found from their stored cells
+    };
+
+    // Leaves a policy of a config to be chosen at runtime through the grid's setters
+    struct runtime_policy {};
+
+    /**
+    * @brief Policies of a grid which are fixed at compile time.
+    *   Dedupe and Order are either a value of dedupe and ordering, or runtime_policy{} to keep set_dedupe and
+    *   set_ordering. A fixed policy removes its setter and its member, and the branches on it from the query paths.
+    *   Allocator is rebound for every list the grid keeps, including the elements themselves. The columns of soa
+    *   elements and the lists returned to the caller use std::allocator
+    */
+    template<auto Dedupe=runtime_policy{}, auto Order=runtime_policy{}, class Allocator=std::allocator<int>>
+    requires (std::is_same_v<std::remove_cv_t<decltype(Dedupe)>, runtime_policy> || std::is_same_v<std::remove_cv_t<decltype(Dedupe)>, dedupe>) &&
+             (std::is_same_v<std::remove_cv_t<decltype(Order)>, runtime_policy> || std::is_same_v<std::remove_cv_t<decltype(Order)>, ordering>)
+    struct config {
+        static constexpr auto dedupe_policy{Dedupe};
+        static constexpr auto ordering_policy{Order};
+        using allocator_type = Allocator;
+    };
+
+    using default_config = config<>;
+
+    template<class Config>
+    concept runtime_dedupe = std::is_same_v<std::remove_cv_t<decltype(Config::dedupe_policy)>, runtime_policy>;
+
+    template<class Config>
+    concept runtime_ordering = std::is_same_v<std::remove_cv_t<decltype(Config::ordering_policy)>, runtime_policy>;
+
+    struct point {
+        int x, y;
+    };
+
+    struct motion {
+        float velocity_x, velocity_y;
+        float horizon; // Length of time the swept bounds are kept for, in the same units of time as the velocity
+    };
+
+    // Shapes which are only inserted into the cells they cover, rather than every cell of their bounding box.
+    //      Coordinates are in the same units as bounds
+    struct circle {
+        float x, y, radius;
+    };
+
+    struct oriented_box {
+        float x, y; // Centre of the box
+        float half_width, half_height;
+        float angle; // Rotation about the centre, in radians
+    };
+
+    struct segment {
+        float x_start, y_start, x_end, y_end;
+    };
+
+#ifdef LIGHTGRID_LATENCY_HISTOGRAMS
+    enum class operation {
+        insert,
+        update,
+        remove,
+        query,
+        visit, // Includes the time spent in the visiting function
+        count
+    };
+
+    /**
+    * @brief Log-linear histogram of latencies, with 16 linear sub-buckets for each power of two (~6% precision).
+    *   Recording is lock-free, so the histogram can be read from other threads while the grid is in use.
+    *   Copies take a snapshot of each counter, so that grids stay copyable and movable with histograms enabled.
+    */
+    class latency_histogram {
+    public:
+        latency_histogram() = default;
+        latency_histogram(const latency_histogram& other);
+        latency_histogram& operator=(const latency_histogram& other);
+
+        void record(uint64_t latency);
+        void reset();
+
+        uint64_t count() const;
+        uint64_t max() const;
+        double mean() const;
+        // The upper bound of the bucket containing the given fraction of recorded latencies, from 0.0 to 1.0
+        uint64_t percentile(double fraction) const;
+
+    private:
+        static constexpr int sub_bucket_bits{4};
+        static constexpr int sub_buckets{1 << sub_bucket_bits};
+        static constexpr int num_buckets{(64 - sub_bucket_bits + 1)*sub_buckets};
+
+        static int bucket(uint64_t latency);
+        static uint64_t bucket_upper_bound(int bucket);
+
+        std::array<std::atomic<uint64_t>, num_buckets> buckets{};
+        std::atomic<uint64_t> total_count{0};
+        std::atomic<uint64_t> total_latency{0};
+        std::atomic<uint64_t> max_latency{0};
+    };
+
+    // Records the time from construction to destruction into a histogram
+    class latency_timer {
+    public:
+        latency_timer(latency_histogram& histogram);
+        ~latency_timer();
+
+        static uint64_t now();
+
+    private:
+        latency_histogram& histogram;
+        uint64_t start;
+    };
+
+    #define LIGHTGRID_TIME_OPERATION(op) const latency_timer operation_timer{this->latencies[static_cast<size_t>(op)]}
+#else
+    #define LIGHTGRID_TIME_OPERATION(op)
+#endif
+
+#ifdef LIGHTGRID_EVENT_COUNTERS
+    struct event_counters {
+        uint64_t nodes_visited{0}; // Cell nodes walked by queries and visits
+        uint64_t duplicates_rejected{0}; // Elements seen again by a query, from elements spanning several cells
+        uint64_t remove_nodes_visited{0}; // Cell nodes walked to find the element being removed
+        uint64_t free_list_hits{0}; // Cell nodes reused from the free list
+        uint64_t node_growths{0}; // Cell nodes appended when the free list is empty
+        uint64_t reallocations{0}; // Cell node list reallocations caused by appending
+    };
+
+    #define LIGHTGRID_COUNT_EVENT(event, amount) this->events.event += (amount)
+#else
+    #define LIGHTGRID_COUNT_EVENT(event, amount)
+#endif
+
+    // Describes element data stored column-wise, with one list per field
+    template<typename... Fields>
+    struct soa {};
+
+    template<typename... Fields>
+    class soa_vector {
+    public:
+        using value_type = std::tuple<Fields...>;
+        using reference = std::tuple<Fields&...>;
+        using const_reference = std::tuple<const Fields&...>;
+
+        reference operator[](size_t index);
+        const_reference operator[](size_t index) const;
+        void push_back(const value_type& value);
+
+        void reserve(size_t num);
+        void clear();
+        size_t size() const;
+        size_t capacity() const;
+
+        template<size_t Field>
+        std::vector<std::tuple_element_t<Field, value_type>>& column();
+        template<size_t Field>
+        const std::vector<std::tuple_element_t<Field, value_type>>& column() const;
+
+    private:
+        std::tuple<std::vector<Fields>...> columns;
+    };
+
+    // Describes elements which are only caller-supplied 32-bit IDs, such as entities kept elsewhere. Each ID is used as its
+    //      element node, so it is stored directly in the cell nodes and no element data or free list is kept. IDs index the
+    //      per-element state, which is sized to the largest ID, so they should be dense
+    struct external_ids {};
+
+    // Stands in for the element list of external_ids, where each element is its own element node
+    class id_list {
+    public:
+        using value_type = uint32_t;
+
+        value_type operator[](size_t index) const { return static_cast<value_type>(index); }
+        void push_back(value_type) {}
+
+        void reserve(size_t) {}
+        void clear() {}
+        size_t size() const { return 0; }
+        size_t capacity() const { return 0; }
+    };
+
+    template<class T>
+    struct element_storage {
+        using value_type = T;
+        using type = std::vector<T>;
+    };
+
+    template<typename... Fields>
+    struct element_storage<soa<Fields...>> {
+        using value_type = std::tuple<Fields...>;
+        using type = soa_vector<Fields...>;
+    };
+
+    template<>
+    struct element_storage<external_ids> {
+        using value_type = uint32_t;
+        using type = id_list;
+    };
+
+    template<class T>
+    using element_value_t = typename element_storage<T>::value_type;
+
+    template<class T>
+    concept external_id_elements = std::is_same_v<T, external_ids>;
+
+    template<class T>
+    concept soa_elements = !std::is_same_v<typename element_storage<T>::type, std::vector<T>> && !external_id_elements<T>;
+
+    template<class T, size_t Field>
+    using field_t = std::tuple_element_t<Field, element_value_t<T>>;
+
+    // Bounds stored column-wise, such as the columns of a grid<soa<...>>, indexed by the candidates given to filter_overlapping
+    struct bounds_columns {
+        std::span<const int> x, y, w, h;
+    };
+
+    // Keeps only the candidates whose bounds overlap the given bounds, compacting them in place to the front of the list
+    //      Returns the number of candidates kept
+    size_t filter_overlapping(const bounds& bounds, const bounds_columns& columns, std::span<int> candidates);
+
+    // Coroutine yielding chunks of values, which only runs while the next chunk is being asked for.
+    //      Each chunk is only valid until the generator is resumed
+    template<typename V>
+    class chunk_generator {
+    public:
+        struct promise_type {
+            std::span<const V> chunk;
+            std::exception_ptr exception;
+
+            chunk_generator get_return_object() { return chunk_generator{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_always final_suspend() noexcept { return {}; }
+            std::suspend_always yield_value(std::span<const V> next_chunk) noexcept { this->chunk = next_chunk; return {}; }
+            void return_void() noexcept {}
+            void unhandled_exception() { this->exception = std::current_exception(); }
+        };
+
+        class iterator {
+        public:
+            explicit iterator(chunk_generator* generator) : generator{generator} {}
+
+            std::span<const V> operator*() const { return this->generator->chunk(); }
+            iterator& operator++() { this->generator->next(); return *this; }
+            bool operator==(std::default_sentinel_t) const { return this->generator->done(); }
+
+        private:
+            chunk_generator* generator;
+        };
+
+        chunk_generator(chunk_generator&& other) noexcept;
+        chunk_generator& operator=(chunk_generator&& other) noexcept;
+        ~chunk_generator();
+
+        // Resumes until the next chunk, returning false once there are no chunks left
+        bool next();
+        bool done() const;
+        std::span<const V> chunk() const;
+
+        // Resumes to the first chunk
+        iterator begin();
+        std::default_sentinel_t end() const;
+
+    private:
+        explicit chunk_generator(std::coroutine_handle<promise_type> handle);
+
+        std::coroutine_handle<promise_type> handle;
+    };
+
     /**
     * @brief Data-structure for spatial lookup.
     * Divides 2D coordinates into cells, allowing for insertion and lookup for 
     *   an arbitrary type T, based on position.
     *   CellSize determines the number of bounds coordinate units mapped to a single node
     *   ZBitWidth is the number of bits used for z-ordering. This will determine the number of nodes used (2^ZBitWidth)
+    *   T may be soa<Fields...> to store the element data column-wise, in which case elements are std::tuple<Fields...>
+    *   T may be external_ids to store only caller-supplied IDs, in which case insert returns the given ID
+    *   Config fixes the dedupe strategy, result ordering and allocator at compile time, see config
     */    
-    template<class T, int CellSize, size_t ZBitWidth=16u>
+    template<class T, int CellSize, size_t ZBitWidth=16u, class Config=default_config>
     requires (ZBitWidth <= sizeof(size_t)*8)
     class grid {
     public:
+        using value_type = element_value_t<T>;
+        // Lists kept by the grid, allocated through the config's allocator
+        template<typename V>
+        using list = std::vector<V, typename std::allocator_traits<typename Config::allocator_type>::template rebind_alloc<V>>;
 
         grid();
 
         void reserve(int num);
         void clear();
+
+        // Deterministic ordering of query and visit results, unordered by default
+        void set_ordering(ordering order) requires runtime_ordering<Config>;
+        // How elements spanning several cells are reported once per query or visit, using the visited set by default
+        void set_dedupe(dedupe strategy) requires runtime_dedupe<Config>;
+
+        // Permutes the elements into the z-order of the first cell they occupy, so that elements near each other in space
+        //      are near each other in memory. Returns a list mapping each old element node to its new element node, or -1
+        //      if the old node was free. External IDs belong to the caller, so can't be reordered
+        std::vector<int> reorder_by_space() requires (!external_id_elements<T>);
         
-        int insert(T element, const bounds& bounds);
-        int insert(T element, const cell_bounds& bounds);
+        int insert(element_value_t<T> element, const bounds& bounds);
+        int insert(element_value_t<T> element, const cell_bounds& bounds);
         void remove(int element_node, const bounds& bounds);
         void remove(int element_node, const cell_bounds& bounds);
         void update(int element_node, const bounds& old_bounds, const bounds& new_bounds);
         void update(int element_node, const cell_bounds& old_bounds, const cell_bounds& new_bounds);
 
+        // Inserts the bounds swept by the element over the motion's horizon, starting at the given time
+        int insert(element_value_t<T> element, const bounds& bounds, const motion& motion, float time);
+        // Only reinserts the element when the horizon has expired, the velocity has changed, or the bounds have left the
+        //      swept bounds. Returns true if the element was reinserted
+        bool update(int element_node, const bounds& bounds, const motion& motion, float time);
+        // Removes an element from the cells it was last inserted into, which the grid keeps for every element
+        void remove(int element_node);
+
+        // Only inserts into the cells the shape covers. The covered cells of each row are kept for the element, so that
+        //      reference point dedupe still reports it once. An element may be updated between shapes of the same kind
+        int insert(element_value_t<T> element, const circle& shape);
+        int insert(element_value_t<T> element, const oriented_box& shape);
+        int insert(element_value_t<T> element, const segment& shape);
+        void remove(int element_node, const circle& shape);
+        void remove(int element_node, const oriented_box& shape);
+        void remove(int element_node, const segment& shape);
+        void update(int element_node, const circle& old_shape, const circle& new_shape);
+        void update(int element_node, const oriented_box& old_shape, const oriented_box& new_shape);
+        void update(int element_node, const segment& old_shape, const segment& new_shape);
+
         template<typename R> 
-        requires insertable<R, T>
+        requires insertable<R, element_value_t<T>>
         R& query(const bounds& bounds, R& results);
         template<typename R> 
-        requires insertable<R, T>
+        requires insertable<R, element_value_t<T>>
         R& query(const cell_bounds& bounds, R& results);
         template<typename R> 
-        requires insertable<R, T>
+        requires insertable<R, element_value_t<T>>
         // Queries world coordinates, not cell indices
         R& query(int x, int y, R& results);
 
-        template<void VisitFunc(T, void*)>      
+        // Scratch used to dedupe and order the results of a const query. Any number of threads may query the grid at once,
+        //      as long as each has its own context and the grid isn't modified in the meantime
+        struct query_context {
+            list<int> last_query;
+            list<bool> query_set;
+            size_t query_size{0};
+            list<int> sort_scratch;
+        };
+
+        // These aren't recorded by the latency histograms or event counters, which aren't safe to share between threads
+        template<typename R>
+        requires insertable<R, element_value_t<T>>
+        R& query(const bounds& bounds, R& results, query_context& context) const;
+        template<typename R>
+        requires insertable<R, element_value_t<T>>
+        R& query(const cell_bounds& bounds, R& results, query_context& context) const;
+
+        // Queries and visits through a const grid need no scratch at all, as they always dedupe by reference point. Any number
+        //      of threads may use them at once, as long as the grid isn't modified in the meantime. Results are in cell order,
+        //      whatever the grid's ordering is set to
+        template<typename R>
+        requires insertable<R, element_value_t<T>>
+        R& query(const bounds& bounds, R& results) const;
+        template<typename R>
+        requires insertable<R, element_value_t<T>>
+        R& query(const cell_bounds& bounds, R& results) const;
+        void visit(const bounds& bounds, void(*VisitFunc)(element_value_t<T>, void*), void* user_data) const;
+        void visit(const cell_bounds& bounds, void(*VisitFunc)(element_value_t<T>, void*), void* user_data) const;
+
+        // Queries many world coordinates at once, replacing the contents of results and offsets. The results for points[i]
+        //      are found from results[offsets[i]] up to results[offsets[i + 1]]. Points are sorted by z-order packed above
+        //      their index, so the z-order must fit in 32 bits
+        void query_points(std::span<const point> points, std::vector<element_value_t<T>>& results, std::vector<size_t>& offsets) requires (ZBitWidth <= 32u);
+
+        template<void VisitFunc(element_value_t<T>, void*)>      
         void visit(const bounds& bounds, void* user_data);
-        template<void VisitFunc(T, void*)>      
+        template<void VisitFunc(element_value_t<T>, void*)>      
         void visit(const cell_bounds& bounds, void* user_data);
-        template<void VisitFunc(T, void*)>      
+        template<void VisitFunc(element_value_t<T>, void*)>      
         void visit(int x, int y, void* user_data);
-        void visit(const bounds& bounds, void(*VisitFunc)(T, void*), void* user_data);
-        void visit(const cell_bounds& bounds, void(*VisitFunc)(T, void*), void* user_data);
-        void visit(int x, int y, void(*VisitFunc)(T, void*), void* user_data);
+        void visit(const bounds& bounds, void(*VisitFunc)(element_value_t<T>, void*), void* user_data);
+        void visit(const cell_bounds& bounds, void(*VisitFunc)(element_value_t<T>, void*), void* user_data);
+        void visit(int x, int y, void(*VisitFunc)(element_value_t<T>, void*), void* user_data);
+
+        // Visits the elements within the bounds a chunk at a time, suspending after every nodes_per_chunk cell nodes so that
+        //      a long scan can be spread out, unless those nodes held no new elements. Each element is only yielded once, from
+        //      the first cell it shares with the bounds, in cell order regardless of the grid's ordering. The grid must not be
+        //      changed while the scan is suspended
+        chunk_generator<element_value_t<T>> visit_async(const bounds& bounds, size_t nodes_per_chunk) const;
+        chunk_generator<element_value_t<T>> visit_async(cell_bounds bounds, size_t nodes_per_chunk) const;
+
+        // Splits the bounds into tiles aligned to the z-order curve, which are visited in parallel by the pool. Instead of
+        //      a visited set, each element is only visited from the first cell it shares with the bounds, so the visitor may
+        //      be called from several threads at once, but only once per element
+        template<typename Visitor, task_pool Pool>
+        requires std::invocable<Visitor&, element_value_t<T>>
+        void parallel_visit(const bounds& bounds, Visitor&& visitor, Pool& pool) const;
+        template<typename Visitor, task_pool Pool>
+        requires std::invocable<Visitor&, element_value_t<T>>
+        void parallel_visit(const cell_bounds& bounds, Visitor&& visitor, Pool& pool) const;
+
+        // Sleeping elements are skipped when paired with other sleeping elements in query_active and visit_active
+        void sleep(int element_node);
+        void wake(int element_node);
+        bool is_sleeping(int element_node) const;
+
+        // Calls visitor(element_node, element) for every awake element, in element node order
+        template<typename Visitor>
+        requires std::invocable<Visitor&, int, element_value_t<T>>
+        void for_each_active(Visitor&& visitor) const;
+
+        // Queries on behalf of the element at element_node. If that element is asleep, only awake elements are returned.
+        //      If it is awake, any returned sleeping elements whose stored cells overlap its own are woken.
+        template<typename R> 
+        requires insertable<R, element_value_t<T>>
+        R& query_active(int element_node, const bounds& bounds, R& results);
+        template<typename R> 
+        requires insertable<R, element_value_t<T>>
+        R& query_active(int element_node, const cell_bounds& bounds, R& results);
+
+        template<void VisitFunc(element_value_t<T>, void*)>      
+        void visit_active(int element_node, const bounds& bounds, void* user_data);
+        template<void VisitFunc(element_value_t<T>, void*)>      
+        void visit_active(int element_node, const cell_bounds& bounds, void* user_data);
         
-        cell_bounds get_cell_bounds(const bounds& bounds);
+        // Element nodes index the columns of soa elements directly
+        template<typename R> 
+        requires insertable<R, int>
+        R& query_nodes(const bounds& bounds, R& results);
+        template<typename R> 
+        requires insertable<R, int>
+        R& query_nodes(const cell_bounds& bounds, R& results);
+
+        // Column access for soa elements, indexed by element node
+        template<size_t Field>
+        requires soa_elements<T>
+        std::span<const field_t<T, Field>> column() const;
+
+        template<size_t Field, typename R>
+        requires soa_elements<T> && insertable<R, field_t<T, Field>>
+        R& query_field(const bounds& bounds, R& results);
+        template<size_t Field, typename R>
+        requires soa_elements<T> && insertable<R, field_t<T, Field>>
+        R& query_field(const cell_bounds& bounds, R& results);
+
+        template<size_t Field, void VisitFunc(field_t<T, Field>, void*)>
+        requires soa_elements<T>
+        void visit_field(const bounds& bounds, void* user_data);
+        template<size_t Field, void VisitFunc(field_t<T, Field>, void*)>
+        requires soa_elements<T>
+        void visit_field(const cell_bounds& bounds, void* user_data);
+        
+        cell_bounds get_cell_bounds(const bounds& bounds) const;
+
+    #ifdef LIGHTGRID_LATENCY_HISTOGRAMS
+        const latency_histogram& latency(operation op) const;
+        void reset_latencies();
+    #endif
+
+    #ifdef LIGHTGRID_EVENT_COUNTERS
+        event_counters counters() const;
+        void reset_counters();
+    #endif
+
+        // Computes the z-order of each (x, y) cell pair, writing them to out. All spans must be the same size
+        void z_order_batch(std::span<const uint32_t> xs, std::span<const uint32_t> ys, std::span<uint64_t> out) const;
 
     private:
         // A mask for wrapping z-orders outside the bounds of the grid
@@ -86,58 +556,387 @@ namespace lightgrid {
             int next=-1; 
         };
 
-        int element_insert(T element);
+        // The config's policy if fixed, otherwise the one set at runtime
+        constexpr ordering ordering_policy() const;
+        constexpr dedupe dedupe_policy() const;
+
+        int element_insert(element_value_t<T> element);
         void element_remove(int element_node);
+        // Sizes the per-element state for a newly inserted element, and records the cells it was inserted into
+        void element_inserted(int element_node, const cell_bounds& bounds);
+        // One past the largest element node which has been used
+        size_t element_node_count() const;
+
+        cell_bounds get_swept_cell_bounds(const bounds& bounds, const motion& motion);
+
+        // Cells covered in one row of a shape
+        struct cell_span {
+            int x_start, x_end;
+        };
+
+        struct vertex {
+            float x, y;
+        };
+
+        // Finds the span of cells covered in each row of the shape, from bounds.y_start to bounds.y_end
+        void rasterise(const circle& shape, cell_bounds& bounds, list<cell_span>& spans) const;
+        void rasterise(const oriented_box& shape, cell_bounds& bounds, list<cell_span>& spans) const;
+        void rasterise(const segment& shape, cell_bounds& bounds, list<cell_span>& spans) const;
+        void rasterise_polygon(std::span<const vertex> vertices, cell_bounds& bounds, list<cell_span>& spans) const;
+        void add_span(float x_min, float x_max, cell_bounds& bounds, list<cell_span>& spans) const;
+
+        template<typename S>
+        int shape_insert(element_value_t<T> element, const S& shape);
+        template<typename S>
+        void shape_remove(int element_node, const S& shape);
+        template<typename S>
+        void shape_update(int element_node, const S& old_shape, const S& new_shape);
+        // Clears the spans of an element inserted with bounds, which may have been a shape before
+        void forget_spans(int element_node);
 
         void cell_insert(int cell_node, int element_node);
         void cell_remove(int cell_node, int element_node);
         void cell_query(int cell_node);
+        // Cell (x, y) of the queried bounds, deduped by the grid's strategy
+        void cell_query(int cell_node, const cell_bounds& bounds, int x, int y);
+        void cell_query(int cell_node, const cell_bounds& bounds, int x, int y, query_context& context) const;
+
+        // Whether the element is seen from the first cell of its intersection with the bounds, where it should be reported
+        bool is_reference_cell(int element_node, const cell_bounds& bounds, int x, int y) const;
 
+        void filter_sleeping(int element_node);
+        void order_query();
+        void sort_elements(std::span<int> elements, list<int>& scratch) const;
         void reset_query_set();
 
         inline uint64_t z_order(uint32_t x, uint32_t y) const;
-        inline uint64_t interleave_with_zeros(uint32_t input) const;
-        inline uint64_t interleave(uint32_t x, uint32_t y) const;
 
-        std::vector<T> elements;
-        std::vector<node> element_nodes;
-        std::vector<node> cell_nodes{std::vector<node>(wrapping_bit_mask + 1)}; // The first cells in this list will never change and will be accessed directly, acting as the 2D list of cells
+        // Plain element lists use the config's allocator, while soa columns and external IDs keep their own storage
+        std::conditional_t<std::is_same_v<typename element_storage<T>::type, std::vector<T>>, list<T>, typename element_storage<T>::type> elements;
 
-        std::vector<int> last_query;
-        std::vector<bool> query_set;
+        list<node> element_nodes; // Elements are indexed by their element node, so these nodes only keep the free list
+        list<cell_bounds> element_bounds; // The cells each element was last inserted into, indexed by element node
+        list<node> cell_nodes{list<node>(wrapping_bit_mask + 1)}; // The first cells in this list will never change and will be accessed directly, acting as the 2D list of cells
+
+        list<int> last_query;
+        list<bool> query_set;
         size_t query_size{0}; // Used to avoid clearing the vector every frame;
 
+        // Reused between point batches to avoid reallocation
+        struct batch_scratch {
+            list<uint32_t> x, y;
+            list<uint64_t> z, sorted;
+            list<int> start, count; // Range of each point's results within elements
+            list<int> elements;
+        } batch;
+
+        // Only stored when left to be set at runtime, where the value initialised policies are unordered and visited_set
+        [[no_unique_address]] std::conditional_t<runtime_ordering<Config>, ordering, runtime_policy> order{};
+        [[no_unique_address]] std::conditional_t<runtime_dedupe<Config>, dedupe, runtime_policy> dedupe_strategy{};
+        list<int> sort_scratch;
+
+        // Removed and unused element nodes are kept asleep, so only live elements are ever active
+        list<bool> sleeping;
+
+    #ifdef LIGHTGRID_LATENCY_HISTOGRAMS
+        std::array<latency_histogram, static_cast<size_t>(operation::count)> latencies;
+    #endif
+
+    #ifdef LIGHTGRID_EVENT_COUNTERS
+        event_counters events;
+    #endif
+
+        // The swept cells are kept in element_bounds, so a prediction only holds what they were swept with.
+        //      Elements without a prediction are treated as expired
+        struct prediction {
+            float velocity_x{0.0f}, velocity_y{0.0f};
+            float expiry{-INFINITY};
+        };
+
+        list<prediction> predictions; // Only sized once an element is inserted with a motion
+
+        // Row spans of elements inserted as shapes, indexed by element node. Only sized once a shape is inserted, and empty
+        //      for elements inserted with bounds
+        list<list<cell_span>> element_spans;
+        list<cell_span> span_scratch;
+
         int free_element_nodes{-1}; // singly linked-list of the free nodes
         int free_cell_nodes{-1}; 
         int num_elements{0};
     };
 
-    template<class T, int CellSize, size_t ZBitWidth>
+    template<typename... Fields>
+    typename soa_vector<Fields...>::reference soa_vector<Fields...>::operator[](size_t index) {
+        return std::apply([index](auto&... columns) { return reference{columns[index]...}; }, this->columns);
+    }
+
+    template<typename... Fields>
+    typename soa_vector<Fields...>::const_reference soa_vector<Fields...>::operator[](size_t index) const {
+        return std::apply([index](const auto&... columns) { return const_reference{columns[index]...}; }, this->columns);
+    }
+
+    template<typename... Fields>
+    void soa_vector<Fields...>::push_back(const value_type& value) {
+        [&]<size_t... Field>(std::index_sequence<Field...>) {
+            (std::get<Field>(this->columns).push_back(std::get<Field>(value)), ...);
+        }(std::index_sequence_for<Fields...>{});
+    }
+
+    template<typename... Fields>
+    void soa_vector<Fields...>::reserve(size_t num) {
+        std::apply([num](auto&... columns) { (columns.reserve(num), ...); }, this->columns);
+    }
+
+    template<typename... Fields>
+    void soa_vector<Fields...>::clear() {
+        std::apply([](auto&... columns) { (columns.clear(), ...); }, this->columns);
+    }
+
+    template<typename... Fields>
+    size_t soa_vector<Fields...>::size() const {
+        return std::get<0>(this->columns).size();
+    }
+
+    template<typename... Fields>
+    size_t soa_vector<Fields...>::capacity() const {
+        return std::get<0>(this->columns).capacity();
+    }
+
+    template<typename... Fields>
+    template<size_t Field>
+    std::vector<std::tuple_element_t<Field, typename soa_vector<Fields...>::value_type>>& soa_vector<Fields...>::column() {
+        return std::get<Field>(this->columns);
+    }
+
+    template<typename... Fields>
+    template<size_t Field>
+    const std::vector<std::tuple_element_t<Field, typename soa_vector<Fields...>::value_type>>& soa_vector<Fields...>::column() const {
+        return std::get<Field>(this->columns);
+    }
+
+    template<typename V>
+    chunk_generator<V>::chunk_generator(std::coroutine_handle<promise_type> handle) : handle{handle} {}
+
+    template<typename V>
+    chunk_generator<V>::chunk_generator(chunk_generator&& other) noexcept : handle{std::exchange(other.handle, nullptr)} {}
+
+    template<typename V>
+    chunk_generator<V>& chunk_generator<V>::operator=(chunk_generator&& other) noexcept {
+        if (this != &other) {
+            if (this->handle) {
+                this->handle.destroy();
+            }
+
+            this->handle = std::exchange(other.handle, nullptr);
+        }
+
+        return *this;
+    }
+
+    template<typename V>
+    chunk_generator<V>::~chunk_generator() {
+        if (this->handle) {
+            this->handle.destroy();
+        }
+    }
+
+    template<typename V>
+    bool chunk_generator<V>::next() {
+        assert(this->handle && "Resumed an empty generator");
+
+        if (this->handle.done()) {
+            return false;
+        }
+
+        this->handle.resume();
+
+        if (this->handle.promise().exception) {
+            std::rethrow_exception(std::exchange(this->handle.promise().exception, nullptr));
+        }
+
+        return !this->handle.done();
+    }
+
+    template<typename V>
+    bool chunk_generator<V>::done() const {
+        return !this->handle || this->handle.done();
+    }
+
+    template<typename V>
+    std::span<const V> chunk_generator<V>::chunk() const {
+        return this->handle.promise().chunk;
+    }
+
+    template<typename V>
+    typename chunk_generator<V>::iterator chunk_generator<V>::begin() {
+        this->next();
+        return iterator{this};
+    }
+
+    template<typename V>
+    std::default_sentinel_t chunk_generator<V>::end() const {
+        return std::default_sentinel;
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
     requires (ZBitWidth <= sizeof(size_t)*8)
-    grid<T, CellSize, ZBitWidth>::grid() {
+    grid<T, CellSize, ZBitWidth, Config>::grid() {
         this->clear();
     }
 
-    template<class T, int CellSize, size_t ZBitWidth>
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
     requires (ZBitWidth <= sizeof(size_t)*8)
-    void grid<T, CellSize, ZBitWidth>::clear() {
+    void grid<T, CellSize, ZBitWidth, Config>::clear() {
         this->elements.clear();
         this->element_nodes.clear();
+        this->element_bounds.clear();
+        this->element_spans.clear();
         this->cell_nodes.clear();
         this->cell_nodes.resize(wrapping_bit_mask + 1);
+
+        // Per-element state is sized again as elements are inserted
+        this->last_query.clear();
+        this->query_set.clear();
+        this->query_size = 0;
+        this->sleeping.clear();
+        this->predictions.clear();
+
+        this->free_element_nodes = -1;
+        this->free_cell_nodes = -1;
+        this->num_elements = 0;
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    void grid<T, CellSize, ZBitWidth, Config>::set_ordering(ordering order) requires runtime_ordering<Config> {
+        this->order = order;
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    void grid<T, CellSize, ZBitWidth, Config>::set_dedupe(dedupe strategy) requires runtime_dedupe<Config> {
+        this->dedupe_strategy = strategy;
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    std::vector<int> grid<T, CellSize, ZBitWidth, Config>::reorder_by_space() requires (!external_id_elements<T>) {
+        const int num_element_nodes = this->element_nodes.size();
+
+        std::vector<int> remap(num_element_nodes, -1);
+        list<int> order;
+        order.reserve(num_element_nodes);
+
+        // Walking the cells in z-order gives each element its position the first time it is seen, so no sort is needed
+        for (int cell_node{0}; cell_node <= wrapping_bit_mask; cell_node++) {
+            for (int current_node{this->cell_nodes[cell_node].next}; current_node != -1; current_node = this->cell_nodes[current_node].next) {
+                const int current_element{this->cell_nodes[current_node].element};
+
+                if (remap[current_element] == -1) {
+                    remap[current_element] = order.size();
+                    order.push_back(current_element);
+                }
+            }
+        }
+
+        list<bool> is_free(num_element_nodes);
+
+        for (int free_node{this->free_element_nodes}; free_node != -1; free_node = this->element_nodes[free_node].next) {
+            is_free[free_node] = true;
+        }
+
+        // Elements which are not in any cell keep their relative order after the rest
+        for (int element_node{0}; element_node < num_element_nodes; element_node++) {
+            if (remap[element_node] == -1 && !is_free[element_node]) {
+                remap[element_node] = order.size();
+                order.push_back(element_node);
+            }
+        }
+
+        const int num_live{static_cast<int>(order.size())};
+
+        // Free nodes are moved to the end, keeping their element slots so they can still be reused
+        for (int element_node{0}; element_node < num_element_nodes; element_node++) {
+            if (is_free[element_node]) {
+                order.push_back(element_node);
+            }
+        }
+
+        decltype(this->elements) new_elements;
+        new_elements.reserve(this->elements.capacity());
+
+        for (auto element_node : order) {
+            new_elements.push_back(std::move(this->elements[element_node]));
+        }
+
+        this->elements = std::move(new_elements);
+
+        // Element nodes now index into the element list directly, with the free nodes linked in ascending order
+        for (int element_node{0}; element_node < num_element_nodes; element_node++) {
+            const bool last{element_node + 1 == num_element_nodes};
+            this->element_nodes[element_node] = node(element_node, (element_node >= num_live && !last) ? element_node + 1 : -1);
+        }
+
+        this->free_element_nodes = (num_live < num_element_nodes) ? num_live : -1;
+
+        // Rebuild the cell lists contiguously in z-order, dropping the free cell nodes
+        list<node> new_cell_nodes(wrapping_bit_mask + 1);
+        new_cell_nodes.reserve(this->cell_nodes.capacity());
+
+        for (int cell_node{0}; cell_node <= wrapping_bit_mask; cell_node++) {
+            int previous_node{cell_node};
+
+            for (int current_node{this->cell_nodes[cell_node].next}; current_node != -1; current_node = this->cell_nodes[current_node].next) {
+                new_cell_nodes[previous_node].next = new_cell_nodes.size();
+                previous_node = new_cell_nodes.size();
+                new_cell_nodes.emplace_back(remap[this->cell_nodes[current_node].element]);
+            }
+        }
+
+        this->cell_nodes = std::move(new_cell_nodes);
+        this->free_cell_nodes = -1;
+
+        // Per-element state follows its element
+        list<bool> new_sleeping(this->sleeping.size(), true);
+        list<cell_bounds> new_element_bounds(num_element_nodes);
+        list<list<cell_span>> new_element_spans(this->element_spans.empty() ? 0 : num_element_nodes);
+        list<prediction> new_predictions(this->predictions.empty() ? 0 : num_element_nodes);
+
+        for (int element_node{0}; element_node < num_live; element_node++) {
+            const int old_node{order[element_node]};
+
+            new_sleeping[element_node] = this->sleeping[old_node];
+            new_element_bounds[element_node] = this->element_bounds[old_node];
+
+            if (old_node < this->element_spans.size()) {
+                new_element_spans[element_node] = std::move(this->element_spans[old_node]);
+            }
+
+            if (old_node < this->predictions.size()) {
+                new_predictions[element_node] = this->predictions[old_node];
+            }
+        }
+
+        this->sleeping = std::move(new_sleeping);
+        this->element_bounds = std::move(new_element_bounds);
+        this->element_spans = std::move(new_element_spans);
+        this->predictions = std::move(new_predictions);
+
+        return remap;
     }
 
-    template<class T, int CellSize, size_t ZBitWidth>
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
     requires (ZBitWidth <= sizeof(size_t)*8)
-    int grid<T, CellSize, ZBitWidth>::insert(T element, const bounds& bounds) {
+    int grid<T, CellSize, ZBitWidth, Config>::insert(element_value_t<T> element, const bounds& bounds) {
         assert(this->cell_nodes.size() > 0 && "Insert attempted on uninitialized grid");
         return this->insert(element, this->get_cell_bounds(bounds));
     }
 
-    template<class T, int CellSize, size_t ZBitWidth>
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
     requires (ZBitWidth <= sizeof(size_t)*8)
-    int grid<T, CellSize, ZBitWidth>::insert(T element, const cell_bounds& bounds) {
+    int grid<T, CellSize, ZBitWidth, Config>::insert(element_value_t<T> element, const cell_bounds& bounds) {
         assert(this->cell_nodes.size() > 0 && "Insert attempted on uninitialized grid");
+        LIGHTGRID_TIME_OPERATION(operation::insert);
 
         int new_element_node = this->element_insert(element);
 
@@ -147,27 +946,24 @@ namespace lightgrid {
             }
         }
 
-        this->num_elements++;
-
-        if (this->query_set.size() < this->num_elements) {
-            this->last_query.resize(this->num_elements);
-            this->query_set.resize(this->num_elements);
-        }
+        this->element_inserted(new_element_node, bounds);
+        this->forget_spans(new_element_node);
 
         return new_element_node;
     }
 
-    template<class T, int CellSize, size_t ZBitWidth>
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
     requires (ZBitWidth <= sizeof(size_t)*8)
-    void grid<T, CellSize, ZBitWidth>::remove(int element_node, const bounds& bounds) {
+    void grid<T, CellSize, ZBitWidth, Config>::remove(int element_node, const bounds& bounds) {
         assert(this->cell_nodes.size() > 0 && "Remove attempted on uninitialized grid");
         this->remove(element_node, this->get_cell_bounds(bounds));
     }
 
-    template<class T, int CellSize, size_t ZBitWidth>
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
     requires (ZBitWidth <= sizeof(size_t)*8)
-    void grid<T, CellSize, ZBitWidth>::remove(int element_node, const cell_bounds& bounds) {
+    void grid<T, CellSize, ZBitWidth, Config>::remove(int element_node, const cell_bounds& bounds) {
         assert(this->cell_nodes.size() > 0 && "Remove attempted on uninitialized grid");
+        LIGHTGRID_TIME_OPERATION(operation::remove);
 
         for (int yy{bounds.y_start}; yy <= bounds.y_end; yy++) {
             for (int xx{bounds.x_start}; xx <= bounds.x_end; xx++) {
@@ -179,17 +975,18 @@ namespace lightgrid {
         this->num_elements--;
     }
 
-    template<class T, int CellSize, size_t ZBitWidth>
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
     requires (ZBitWidth <= sizeof(size_t)*8)
-    void grid<T, CellSize, ZBitWidth>::update(int element_node, const bounds& old_bounds, const bounds& new_bounds) {
+    void grid<T, CellSize, ZBitWidth, Config>::update(int element_node, const bounds& old_bounds, const bounds& new_bounds) {
         assert(this->cell_nodes.size() > 0 && "Update attempted on uninitialized grid");
         this->update(element_node, this->get_cell_bounds(old_bounds), this->get_cell_bounds(new_bounds));
     }
 
-    template<class T, int CellSize, size_t ZBitWidth>
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
     requires (ZBitWidth <= sizeof(size_t)*8)
-    void grid<T, CellSize, ZBitWidth>::update(int element_node, const cell_bounds& old_bounds, const cell_bounds& new_bounds) {
+    void grid<T, CellSize, ZBitWidth, Config>::update(int element_node, const cell_bounds& old_bounds, const cell_bounds& new_bounds) {
         assert(this->cell_nodes.size() > 0 && "Update attempted on uninitialized grid");
+        LIGHTGRID_TIME_OPERATION(operation::update);
 
         // It may seem reasonable to look for the intersection of the bounds to avoid removing and inserting from the same cells,
         //      but if the cells are near or slightly larger than the average object size, then the average intersection of bounds
@@ -209,69 +1006,217 @@ namespace lightgrid {
                 this->cell_insert(this->z_order(xx, yy), element_node);     
             }
         }
+
+        this->element_bounds[element_node] = new_bounds;
+        this->forget_spans(element_node);
     }
 
-    template<class T, int CellSize, size_t ZBitWidth>
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
     requires (ZBitWidth <= sizeof(size_t)*8)
-    void grid<T, CellSize, ZBitWidth>::reserve(int num) {
-        this->elements.reserve(num);
-        this->cell_nodes.reserve(wrapping_bit_mask + num);
-        this->element_nodes.reserve(num);
-    }
+    int grid<T, CellSize, ZBitWidth, Config>::insert(element_value_t<T> element, const bounds& bounds, const motion& motion, float time) {
+        assert(this->cell_nodes.size() > 0 && "Insert attempted on uninitialized grid");
 
+        const cell_bounds swept{this->get_swept_cell_bounds(bounds, motion)};
+        const int new_element_node{this->insert(element, swept)};
 
-    template<class T, int CellSize, size_t ZBitWidth>
-    requires (ZBitWidth <= sizeof(size_t)*8)
-    template<typename R> 
-    requires insertable<R, T>
-    R& grid<T, CellSize, ZBitWidth>::query(const bounds& bounds, R& results) {
-        assert(this->cell_nodes.size() > 0 && "Query attempted on uninitialized grid");
-        return this->query(this->get_cell_bounds(bounds), results);
+        if (this->predictions.size() <= new_element_node) {
+            this->predictions.resize(new_element_node + 1);
+        }
+
+        this->predictions[new_element_node] = {motion.velocity_x, motion.velocity_y, time + motion.horizon};
+
+        return new_element_node;
     }
 
-    template<class T, int CellSize, size_t ZBitWidth>
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
     requires (ZBitWidth <= sizeof(size_t)*8)
-    template<typename R> 
-    requires insertable<R, T>
-    R& grid<T, CellSize, ZBitWidth>::query(const cell_bounds& bounds, R& results) {
-        assert(this->cell_nodes.size() > 0 && "Query attempted on uninitialized grid");
+    bool grid<T, CellSize, ZBitWidth, Config>::update(int element_node, const bounds& bounds, const motion& motion, float time) {
+        assert(this->cell_nodes.size() > 0 && "Update attempted on uninitialized grid");
 
-        for (int yy{bounds.y_start}; yy <= bounds.y_end; yy++) {
-            for (int xx{bounds.x_start}; xx <= bounds.x_end; xx++) {
-                this->cell_query(this->z_order(xx, yy));     
-            }
+        // The element may have been inserted or updated without a motion
+        if (this->predictions.size() <= element_node) {
+            this->predictions.resize(element_node + 1);
         }
 
-        std::span query_span{last_query.begin(), this->query_size};
-        
-        std::transform(query_span.begin(), query_span.end(), std::inserter(results, results.end()), 
-            ([this](const auto& element) {
-                return this->elements[this->element_nodes[element].element];
-            })
-        );
+        prediction& predicted{this->predictions[element_node]};
+        const cell_bounds stored{this->element_bounds[element_node]};
 
-        this->reset_query_set();
+        if (time < predicted.expiry && motion.velocity_x == predicted.velocity_x && motion.velocity_y == predicted.velocity_y) {
+
+            // The element may still have been moved outside of its path, such as by collision resolution
+            const cell_bounds current{this->get_cell_bounds(bounds)};
+
+            if (current.x_start >= stored.x_start && current.x_end <= stored.x_end &&
+                current.y_start >= stored.y_start && current.y_end <= stored.y_end) {
+                return false;
+            }
+        }
+
+        const cell_bounds swept{this->get_swept_cell_bounds(bounds, motion)};
+        this->update(element_node, stored, swept);
+
+        predicted = {motion.velocity_x, motion.velocity_y, time + motion.horizon};
+
+        return true;
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    void grid<T, CellSize, ZBitWidth, Config>::remove(int element_node) {
+        assert(this->cell_nodes.size() > 0 && "Remove attempted on uninitialized grid");
+        const cell_bounds stored{this->element_bounds[element_node]};
+
+        // Shapes only cover some of the cells of their bounds
+        if (element_node < this->element_spans.size() && !this->element_spans[element_node].empty()) {
+            LIGHTGRID_TIME_OPERATION(operation::remove);
+
+            const list<cell_span>& spans{this->element_spans[element_node]};
+
+            for (int row{0}; row < spans.size(); row++) {
+                for (int xx{spans[row].x_start}; xx <= spans[row].x_end; xx++) {
+                    this->cell_remove(this->z_order(xx, stored.y_start + row), element_node);
+                }
+            }
+
+            this->forget_spans(element_node);
+            this->element_remove(element_node);
+            this->num_elements--;
+            return;
+        }
+
+        this->remove(element_node, stored);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    int grid<T, CellSize, ZBitWidth, Config>::insert(element_value_t<T> element, const circle& shape) {
+        assert(this->cell_nodes.size() > 0 && "Insert attempted on uninitialized grid");
+        return this->shape_insert(element, shape);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    int grid<T, CellSize, ZBitWidth, Config>::insert(element_value_t<T> element, const oriented_box& shape) {
+        assert(this->cell_nodes.size() > 0 && "Insert attempted on uninitialized grid");
+        return this->shape_insert(element, shape);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    int grid<T, CellSize, ZBitWidth, Config>::insert(element_value_t<T> element, const segment& shape) {
+        assert(this->cell_nodes.size() > 0 && "Insert attempted on uninitialized grid");
+        return this->shape_insert(element, shape);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    void grid<T, CellSize, ZBitWidth, Config>::remove(int element_node, const circle& shape) {
+        assert(this->cell_nodes.size() > 0 && "Remove attempted on uninitialized grid");
+        this->shape_remove(element_node, shape);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    void grid<T, CellSize, ZBitWidth, Config>::remove(int element_node, const oriented_box& shape) {
+        assert(this->cell_nodes.size() > 0 && "Remove attempted on uninitialized grid");
+        this->shape_remove(element_node, shape);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    void grid<T, CellSize, ZBitWidth, Config>::remove(int element_node, const segment& shape) {
+        assert(this->cell_nodes.size() > 0 && "Remove attempted on uninitialized grid");
+        this->shape_remove(element_node, shape);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    void grid<T, CellSize, ZBitWidth, Config>::update(int element_node, const circle& old_shape, const circle& new_shape) {
+        assert(this->cell_nodes.size() > 0 && "Update attempted on uninitialized grid");
+        this->shape_update(element_node, old_shape, new_shape);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    void grid<T, CellSize, ZBitWidth, Config>::update(int element_node, const oriented_box& old_shape, const oriented_box& new_shape) {
+        assert(this->cell_nodes.size() > 0 && "Update attempted on uninitialized grid");
+        this->shape_update(element_node, old_shape, new_shape);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    void grid<T, CellSize, ZBitWidth, Config>::update(int element_node, const segment& old_shape, const segment& new_shape) {
+        assert(this->cell_nodes.size() > 0 && "Update attempted on uninitialized grid");
+        this->shape_update(element_node, old_shape, new_shape);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    void grid<T, CellSize, ZBitWidth, Config>::reserve(int num) {
+        this->elements.reserve(num);
+        this->cell_nodes.reserve(wrapping_bit_mask + num);
+        this->element_nodes.reserve(num);
+    }
+
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    template<typename R> 
+    requires insertable<R, element_value_t<T>>
+    R& grid<T, CellSize, ZBitWidth, Config>::query(const bounds& bounds, R& results) {
+        assert(this->cell_nodes.size() > 0 && "Query attempted on uninitialized grid");
+        return this->query(this->get_cell_bounds(bounds), results);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    template<typename R> 
+    requires insertable<R, element_value_t<T>>
+    R& grid<T, CellSize, ZBitWidth, Config>::query(const cell_bounds& bounds, R& results) {
+        assert(this->cell_nodes.size() > 0 && "Query attempted on uninitialized grid");
+        LIGHTGRID_TIME_OPERATION(operation::query);
+
+        for (int yy{bounds.y_start}; yy <= bounds.y_end; yy++) {
+            for (int xx{bounds.x_start}; xx <= bounds.x_end; xx++) {
+                this->cell_query(this->z_order(xx, yy), bounds, xx, yy);     
+            }
+        }
+
+        this->order_query();
+
+        std::span query_span{last_query.begin(), this->query_size};
+        
+        std::transform(query_span.begin(), query_span.end(), std::inserter(results, results.end()), 
+            ([this](const auto& element) {
+                return this->elements[element];
+            })
+        );
+
+        this->reset_query_set();
 
         return results;
     }
 
-    template<class T, int CellSize, size_t ZBitWidth>
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
     requires (ZBitWidth <= sizeof(size_t)*8)
     template<typename R> 
-    requires insertable<R, T>
-    R& grid<T, CellSize, ZBitWidth>::query(int x, int y, R& results) {
+    requires insertable<R, element_value_t<T>>
+    R& grid<T, CellSize, ZBitWidth, Config>::query(int x, int y, R& results) {
         assert(this->cell_nodes.size() > 0 && "Query attempted on uninitialized grid");
+        LIGHTGRID_TIME_OPERATION(operation::query);
 
         const int scaled_x = x / CellSize;
         const int scaled_y = y / CellSize;
 
         this->cell_query(this->z_order(scaled_x, scaled_y));     
 
+        this->order_query();
+
         std::span query_span{last_query.begin(), this->query_size};
         
         std::transform(query_span.begin(), query_span.end(), std::inserter(results, results.end()), 
             ([this](const auto& element) {
-                return this->elements[this->element_nodes[element].element];
+                return this->elements[element];
             })
         );
 
@@ -280,194 +1225,814 @@ namespace lightgrid {
         return results;
     }
 
-    template<class T, int CellSize, size_t ZBitWidth>
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    template<typename R>
+    requires insertable<R, element_value_t<T>>
+    R& grid<T, CellSize, ZBitWidth, Config>::query(const bounds& bounds, R& results, query_context& context) const {
+        assert(this->cell_nodes.size() > 0 && "Query attempted on uninitialized grid");
+        return this->query(this->get_cell_bounds(bounds), results, context);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    template<typename R>
+    requires insertable<R, element_value_t<T>>
+    R& grid<T, CellSize, ZBitWidth, Config>::query(const cell_bounds& bounds, R& results, query_context& context) const {
+        assert(this->cell_nodes.size() > 0 && "Query attempted on uninitialized grid");
+
+        // The context may have been made before elements were added
+        if (context.query_set.size() < this->element_node_count()) {
+            context.last_query.resize(this->element_node_count() + 1);
+            context.query_set.resize(this->element_node_count());
+        }
+
+        for (int yy{bounds.y_start}; yy <= bounds.y_end; yy++) {
+            for (int xx{bounds.x_start}; xx <= bounds.x_end; xx++) {
+                this->cell_query(this->z_order(xx, yy), bounds, xx, yy, context);
+            }
+        }
+
+        std::span query_span{context.last_query.begin(), context.query_size};
+
+        if (this->ordering_policy() == ordering::by_element_node) {
+            this->sort_elements(query_span, context.sort_scratch);
+        }
+
+        std::transform(query_span.begin(), query_span.end(), std::inserter(results, results.end()),
+            ([this](const auto& element) {
+                return this->elements[element];
+            })
+        );
+
+        for (auto element : query_span) {
+            context.query_set[element] = false;
+        }
+
+        context.query_size = 0;
+
+        return results;
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    template<typename R>
+    requires insertable<R, element_value_t<T>>
+    R& grid<T, CellSize, ZBitWidth, Config>::query(const bounds& bounds, R& results) const {
+        assert(this->cell_nodes.size() > 0 && "Query attempted on uninitialized grid");
+        return this->query(this->get_cell_bounds(bounds), results);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    template<typename R>
+    requires insertable<R, element_value_t<T>>
+    R& grid<T, CellSize, ZBitWidth, Config>::query(const cell_bounds& bounds, R& results) const {
+        assert(this->cell_nodes.size() > 0 && "Query attempted on uninitialized grid");
+
+        for (int yy{bounds.y_start}; yy <= bounds.y_end; yy++) {
+            for (int xx{bounds.x_start}; xx <= bounds.x_end; xx++) {
+                for (int current_node{this->cell_nodes[this->z_order(xx, yy)].next}; current_node != -1; current_node = this->cell_nodes[current_node].next) {
+                    const int current_element{this->cell_nodes[current_node].element};
+
+                    if (this->is_reference_cell(current_element, bounds, xx, yy)) {
+                        results.insert(results.end(), this->elements[current_element]);
+                    }
+                }
+            }
+        }
+
+        return results;
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    void grid<T, CellSize, ZBitWidth, Config>::visit(const bounds& bounds, void(*VisitFunc)(element_value_t<T>, void*), void* user_data) const {
+        assert(this->cell_nodes.size() > 0 && "Visit attempted on uninitialized grid");
+        this->visit(this->get_cell_bounds(bounds), VisitFunc, user_data);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    void grid<T, CellSize, ZBitWidth, Config>::visit(const cell_bounds& bounds, void(*VisitFunc)(element_value_t<T>, void*), void* user_data) const {
+        assert(this->cell_nodes.size() > 0 && "Visit attempted on uninitialized grid");
+
+        for (int yy{bounds.y_start}; yy <= bounds.y_end; yy++) {
+            for (int xx{bounds.x_start}; xx <= bounds.x_end; xx++) {
+                for (int current_node{this->cell_nodes[this->z_order(xx, yy)].next}; current_node != -1; current_node = this->cell_nodes[current_node].next) {
+                    const int current_element{this->cell_nodes[current_node].element};
+
+                    if (this->is_reference_cell(current_element, bounds, xx, yy)) {
+                        VisitFunc(this->elements[current_element], user_data);
+                    }
+                }
+            }
+        }
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    void grid<T, CellSize, ZBitWidth, Config>::query_points(std::span<const point> points, std::vector<element_value_t<T>>& results, std::vector<size_t>& offsets) requires (ZBitWidth <= 32u) {
+        assert(this->cell_nodes.size() > 0 && "Query attempted on uninitialized grid");
+        LIGHTGRID_TIME_OPERATION(operation::query);
+
+        const size_t num_points{points.size()};
+
+        this->batch.x.resize(num_points);
+        this->batch.y.resize(num_points);
+        this->batch.z.resize(num_points);
+        this->batch.start.resize(num_points);
+        this->batch.count.resize(num_points);
+        this->batch.elements.clear();
+
+        for (size_t it{0}; it < num_points; it++) {
+            this->batch.x[it] = points[it].x / CellSize;
+            this->batch.y[it] = points[it].y / CellSize;
+        }
+
+        this->z_order_batch(this->batch.x, this->batch.y, this->batch.z);
+
+        // The z-order and point index are packed together and sorted with an LSD radix sort over the z-order bits.
+        //      As the sort is stable, the point index is not part of the key
+        for (size_t it{0}; it < num_points; it++) {
+            this->batch.z[it] = (this->batch.z[it] << 32) | it;
+        }
+
+        this->batch.sorted.resize(num_points);
+
+        for (size_t shift{32}; shift < 32 + ZBitWidth; shift += 8) {
+            std::array<size_t, 257> digit_offsets{};
+
+            for (auto key : this->batch.z) {
+                digit_offsets[((key >> shift) & 0xff) + 1]++;
+            }
+            for (size_t digit{1}; digit < digit_offsets.size(); digit++) {
+                digit_offsets[digit] += digit_offsets[digit - 1];
+            }
+            for (auto key : this->batch.z) {
+                this->batch.sorted[digit_offsets[(key >> shift) & 0xff]++] = key;
+            }
+
+            std::swap(this->batch.z, this->batch.sorted);
+        }
+
+        // Points in the same cell are grouped by the sort, so each cell's list is only walked once per group.
+        //      Each point touches a single cell, so no dedupe is needed
+        for (size_t group{0}; group < num_points;) {
+            const uint64_t cell_node{this->batch.z[group] >> 32};
+            const int start = this->batch.elements.size();
+
+            for (int current_node{this->cell_nodes[cell_node].next}; current_node != -1; current_node = this->cell_nodes[current_node].next) {
+                this->batch.elements.push_back(this->cell_nodes[current_node].element);
+                LIGHTGRID_COUNT_EVENT(nodes_visited, 1);
+            }
+
+            const int count = this->batch.elements.size() - start;
+
+            if (this->ordering_policy() == ordering::by_element_node) {
+                this->sort_elements({this->batch.elements.begin() + start, this->batch.elements.end()}, this->sort_scratch);
+            }
+
+            for (; group < num_points && (this->batch.z[group] >> 32) == cell_node; group++) {
+                const uint32_t point_index = this->batch.z[group];
+
+                this->batch.start[point_index] = start;
+                this->batch.count[point_index] = count;
+            }
+        }
+
+        offsets.resize(num_points + 1);
+        offsets[0] = 0;
+
+        for (size_t it{0}; it < num_points; it++) {
+            offsets[it + 1] = offsets[it] + this->batch.count[it];
+        }
+
+        results.clear();
+        results.reserve(offsets[num_points]);
+
+        for (size_t it{0}; it < num_points; it++) {
+            const int start{this->batch.start[it]};
+
+            for (int element{start}; element < start + this->batch.count[it]; element++) {
+                results.push_back(this->elements[this->batch.elements[element]]);
+            }
+        }
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
     requires (ZBitWidth <= sizeof(size_t)*8)
-    template<void VisitFunc(T, void*)>  
-    void grid<T, CellSize, ZBitWidth>::visit(const bounds& bounds, void* user_data) {
+    template<void VisitFunc(element_value_t<T>, void*)>  
+    void grid<T, CellSize, ZBitWidth, Config>::visit(const bounds& bounds, void* user_data) {
         assert(this->cell_nodes.size() > 0 && "Visit attempted on uninitialized grid");
         this->visit<VisitFunc>(this->get_cell_bounds(bounds), user_data);
     }
 
-    template<class T, int CellSize, size_t ZBitWidth>
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
     requires (ZBitWidth <= sizeof(size_t)*8)
-    template<void VisitFunc(T, void*)>  
-    void grid<T, CellSize, ZBitWidth>::visit(const cell_bounds& bounds, void* user_data) {
+    template<void VisitFunc(element_value_t<T>, void*)>  
+    void grid<T, CellSize, ZBitWidth, Config>::visit(const cell_bounds& bounds, void* user_data) {
         assert(this->cell_nodes.size() > 0 && "Visit attempted on uninitialized grid");
+        LIGHTGRID_TIME_OPERATION(operation::visit);
 
         for (int yy{bounds.y_start}; yy <= bounds.y_end; yy++) {
             for (int xx{bounds.x_start}; xx <= bounds.x_end; xx++) {
-                this->cell_query(this->z_order(xx, yy));     
+                this->cell_query(this->z_order(xx, yy), bounds, xx, yy);     
             }
         }
 
+        this->order_query();
+
         std::span query_span{last_query.begin(), this->query_size};
 
         for (auto element : query_span) {
-            VisitFunc(this->elements[this->element_nodes[element].element], user_data);
+            VisitFunc(this->elements[element], user_data);
         }
 
         this->reset_query_set();
     }
 
-    template<class T, int CellSize, size_t ZBitWidth>
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
     requires (ZBitWidth <= sizeof(size_t)*8)
-    template<void VisitFunc(T, void*)>  
-    void grid<T, CellSize, ZBitWidth>::visit(int x, int y, void* user_data) {
+    template<void VisitFunc(element_value_t<T>, void*)>  
+    void grid<T, CellSize, ZBitWidth, Config>::visit(int x, int y, void* user_data) {
         assert(this->cell_nodes.size() > 0 && "Visit attempted on uninitialized grid");
+        LIGHTGRID_TIME_OPERATION(operation::visit);
 
         const int scaled_x = x / CellSize;
         const int scaled_y = y / CellSize;
 
         this->cell_query(this->z_order(scaled_x, scaled_y));     
         
+        this->order_query();
+
         std::span query_span{last_query.begin(), this->query_size};
 
         for (auto element : query_span) {
-            VisitFunc(this->elements[this->element_nodes[element].element], user_data);
+            VisitFunc(this->elements[element], user_data);
         }
 
         this->reset_query_set();
     }
 
-    template<class T, int CellSize, size_t ZBitWidth>
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
     requires (ZBitWidth <= sizeof(size_t)*8)
-    void grid<T, CellSize, ZBitWidth>::visit(const bounds& bounds, void(*VisitFunc)(T, void*), void* user_data) {
+    void grid<T, CellSize, ZBitWidth, Config>::visit(const bounds& bounds, void(*VisitFunc)(element_value_t<T>, void*), void* user_data) {
         assert(this->cell_nodes.size() > 0 && "Visit attempted on uninitialized grid");
         this->visit(this->get_cell_bounds(bounds), VisitFunc, user_data);
     }
 
-    template<class T, int CellSize, size_t ZBitWidth>
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
     requires (ZBitWidth <= sizeof(size_t)*8)
-    void grid<T, CellSize, ZBitWidth>::visit(const cell_bounds& bounds, void(*VisitFunc)(T, void*), void* user_data) {
+    void grid<T, CellSize, ZBitWidth, Config>::visit(const cell_bounds& bounds, void(*VisitFunc)(element_value_t<T>, void*), void* user_data) {
         assert(this->cell_nodes.size() > 0 && "Visit attempted on uninitialized grid");
+        LIGHTGRID_TIME_OPERATION(operation::visit);
 
         for (int yy{bounds.y_start}; yy <= bounds.y_end; yy++) {
             for (int xx{bounds.x_start}; xx <= bounds.x_end; xx++) {
-                this->cell_query(this->z_order(xx, yy));     
+                this->cell_query(this->z_order(xx, yy), bounds, xx, yy);     
             }
         }
 
+        this->order_query();
+
         std::span query_span{last_query.begin(), this->query_size};
 
         for (auto element : query_span) {
-            VisitFunc(this->elements[this->element_nodes[element].element], user_data);
+            VisitFunc(this->elements[element], user_data);
         }
 
         this->reset_query_set();
     }
 
-    template<class T, int CellSize, size_t ZBitWidth>
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
     requires (ZBitWidth <= sizeof(size_t)*8)
-    void grid<T, CellSize, ZBitWidth>::visit(int x, int y, void(*VisitFunc)(T, void*), void* user_data) {
+    void grid<T, CellSize, ZBitWidth, Config>::visit(int x, int y, void(*VisitFunc)(element_value_t<T>, void*), void* user_data) {
         assert(this->cell_nodes.size() > 0 && "Visit attempted on uninitialized grid");
+        LIGHTGRID_TIME_OPERATION(operation::visit);
 
         const int scaled_x = x / CellSize;
         const int scaled_y = y / CellSize;
 
         this->cell_query(this->z_order(scaled_x, scaled_y));     
 
+        this->order_query();
+
         std::span query_span{last_query.begin(), this->query_size};
 
         for (auto element : query_span) {
-            VisitFunc(this->elements[this->element_nodes[element].element], user_data);
+            VisitFunc(this->elements[element], user_data);
         }
 
         this->reset_query_set();
     }
 
-    template<class T, int CellSize, size_t ZBitWidth>
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    chunk_generator<element_value_t<T>> grid<T, CellSize, ZBitWidth, Config>::visit_async(const bounds& bounds, size_t nodes_per_chunk) const {
+        assert(this->cell_nodes.size() > 0 && "Visit attempted on uninitialized grid");
+        return this->visit_async(this->get_cell_bounds(bounds), nodes_per_chunk);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
     requires (ZBitWidth <= sizeof(size_t)*8)
-    inline int grid<T, CellSize, ZBitWidth>::element_insert(T element) {
-        int new_element_node;
+    chunk_generator<element_value_t<T>> grid<T, CellSize, ZBitWidth, Config>::visit_async(cell_bounds bounds, size_t nodes_per_chunk) const {
+        assert(this->cell_nodes.size() > 0 && "Visit attempted on uninitialized grid");
+        assert(nodes_per_chunk > 0 && "Visit attempted with empty chunks");
+
+        // Elements are deduped by reference point, so the scan needs no scratch shared with other queries which may run
+        //      while it is suspended
+        list<element_value_t<T>> chunk;
+        chunk.reserve(nodes_per_chunk);
+
+        size_t chunk_nodes{0};
 
-        if (this->free_element_nodes != -1) {
+        for (int yy{bounds.y_start}; yy <= bounds.y_end; yy++) {
+            for (int xx{bounds.x_start}; xx <= bounds.x_end; xx++) {
 
-            // Use the first item in the linked list and move the head to the next free node
-            new_element_node = this->free_element_nodes;
-            free_element_nodes = this->element_nodes[this->free_element_nodes].next;
+                for (int current_node{this->cell_nodes[this->z_order(xx, yy)].next}; current_node != -1; current_node = this->cell_nodes[current_node].next) {
+                    const int current_element{this->cell_nodes[current_node].element};
 
-            this->elements[element_nodes[new_element_node].element] = element;
+                    if (this->is_reference_cell(current_element, bounds, xx, yy)) {
+                        chunk.push_back(this->elements[current_element]);
+                    }
 
-        } else {
+                    // Nodes of elements seen from an earlier cell are still counted, but empty chunks are never yielded
+                    if (++chunk_nodes == nodes_per_chunk) {
+                        if (!chunk.empty()) {
+                            co_yield std::span<const element_value_t<T>>{chunk};
+                            chunk.clear();
+                        }
 
-            // Create new element node and add reference to index into elements list
-            new_element_node = this->element_nodes.size();
-            this->element_nodes.emplace_back(this->elements.size());
-            this->elements.push_back(element);
+                        chunk_nodes = 0;
+                    }
+                }
+            }
         }
 
-        return new_element_node;
+        if (!chunk.empty()) {
+            co_yield std::span<const element_value_t<T>>{chunk};
+        }
     }
 
-    template<class T, int CellSize, size_t ZBitWidth>
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
     requires (ZBitWidth <= sizeof(size_t)*8)
-    inline void grid<T, CellSize, ZBitWidth>::element_remove(int element_node) {
-        // Make the given element_node the head of the free_element_nodes list
-        this->element_nodes[element_node].next = this->free_element_nodes;
-        this->free_element_nodes = element_node;
+    template<typename Visitor, task_pool Pool>
+    requires std::invocable<Visitor&, element_value_t<T>>
+    void grid<T, CellSize, ZBitWidth, Config>::parallel_visit(const bounds& bounds, Visitor&& visitor, Pool& pool) const {
+        assert(this->cell_nodes.size() > 0 && "Visit attempted on uninitialized grid");
+        this->parallel_visit(this->get_cell_bounds(bounds), visitor, pool);
     }
 
-    template<class T, int CellSize, size_t ZBitWidth>
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
     requires (ZBitWidth <= sizeof(size_t)*8)
-    inline void grid<T, CellSize, ZBitWidth>::cell_insert(int cell_node, int element_node) {
-        if (this->free_cell_nodes != -1) {
+    template<typename Visitor, task_pool Pool>
+    requires std::invocable<Visitor&, element_value_t<T>>
+    void grid<T, CellSize, ZBitWidth, Config>::parallel_visit(const cell_bounds& bounds, Visitor&& visitor, Pool& pool) const {
+        assert(this->cell_nodes.size() > 0 && "Visit attempted on uninitialized grid");
 
-            // Use element of free node as scratchpad for next free node
-            this->cell_nodes[this->free_cell_nodes].element = this->cell_nodes[this->free_cell_nodes].next;
+        if (bounds.x_end < bounds.x_start || bounds.y_end < bounds.y_start) {
+            return;
+        }
 
-            // Move head of cell's linked list to the free node
-            this->cell_nodes[this->free_cell_nodes].next = this->cell_nodes[cell_node].next;
-            this->cell_nodes[cell_node].next = this->free_cell_nodes;
+        // A tile of 2^k by 2^k cells aligned to a multiple of 2^k covers a single range of the z-order curve. The largest
+        //      tiles which still give every worker several tiles to balance between them are used
+        const size_t min_tiles{4*static_cast<size_t>(pool.size())};
 
-            // Move head of free nodes to the value in scratchpad and set head of cell to the element node
-            this->free_cell_nodes = this->cell_nodes[this->free_cell_nodes].element;
-            this->cell_nodes[this->cell_nodes[cell_node].next].element = element_node;
+        int tile_bits{5};
+        int tiles_x, tiles_y;
 
-        } else {
-            // Create new cell node and add reference to index into element_nodes list
-            this->cell_nodes.emplace_back(element_node, this->cell_nodes[cell_node].next);
-            this->cell_nodes[cell_node].next = this->cell_nodes.size() - 1;
+        for (;; tile_bits--) {
+            tiles_x = (bounds.x_end >> tile_bits) - (bounds.x_start >> tile_bits) + 1;
+            tiles_y = (bounds.y_end >> tile_bits) - (bounds.y_start >> tile_bits) + 1;
+
+            if (tile_bits == 0 || static_cast<size_t>(tiles_x)*tiles_y >= min_tiles) {
+                break;
+            }
         }
+
+        const int first_tile_x{bounds.x_start >> tile_bits};
+        const int first_tile_y{bounds.y_start >> tile_bits};
+
+        pool.run(static_cast<size_t>(tiles_x)*tiles_y, [&](size_t tile) {
+            const int tile_x{first_tile_x + static_cast<int>(tile % tiles_x)};
+            const int tile_y{first_tile_y + static_cast<int>(tile / tiles_x)};
+
+            // Tiles on the edge of the bounds are clipped to them
+            const int x_start{std::max(tile_x << tile_bits, bounds.x_start)};
+            const int y_start{std::max(tile_y << tile_bits, bounds.y_start)};
+            const int x_end{std::min(((tile_x + 1) << tile_bits) - 1, bounds.x_end)};
+            const int y_end{std::min(((tile_y + 1) << tile_bits) - 1, bounds.y_end)};
+
+            for (int yy{y_start}; yy <= y_end; yy++) {
+                for (int xx{x_start}; xx <= x_end; xx++) {
+                    for (int current_node{this->cell_nodes[this->z_order(xx, yy)].next}; current_node != -1; current_node = this->cell_nodes[current_node].next) {
+                        const int current_element{this->cell_nodes[current_node].element};
+
+                        if (this->is_reference_cell(current_element, bounds, xx, yy)) {
+                            visitor(this->elements[current_element]);
+                        }
+                    }
+                }
+            }
+        });
     }
 
-    template<class T, int CellSize, size_t ZBitWidth>
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
     requires (ZBitWidth <= sizeof(size_t)*8)
-    inline void grid<T, CellSize, ZBitWidth>::cell_remove(int cell_node, int element_node) {
-        int previous_node{-1};
-        int current_node{cell_node};
+    template<typename R> 
+    requires insertable<R, int>
+    R& grid<T, CellSize, ZBitWidth, Config>::query_nodes(const bounds& bounds, R& results) {
+        assert(this->cell_nodes.size() > 0 && "Query attempted on uninitialized grid");
+        return this->query_nodes(this->get_cell_bounds(bounds), results);
+    }
 
-        // Find the element_node in the cell_node's list
-        do {
-            if (current_node == -1 /** || this->cell_nodes[current_node].element == -1/***/) {
-                return;
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    template<typename R> 
+    requires insertable<R, int>
+    R& grid<T, CellSize, ZBitWidth, Config>::query_nodes(const cell_bounds& bounds, R& results) {
+        assert(this->cell_nodes.size() > 0 && "Query attempted on uninitialized grid");
+        LIGHTGRID_TIME_OPERATION(operation::query);
+
+        for (int yy{bounds.y_start}; yy <= bounds.y_end; yy++) {
+            for (int xx{bounds.x_start}; xx <= bounds.x_end; xx++) {
+                this->cell_query(this->z_order(xx, yy), bounds, xx, yy);     
             }
-            previous_node = current_node;
-            current_node = this->cell_nodes[current_node].next;
         }
-        while (this->cell_nodes[current_node].element != element_node);
 
-        // Remove the cell_node containing element_node
-        this->cell_nodes[previous_node].next = this->cell_nodes[current_node].next;
-        // Make the currentNode the head of the free_cell_nodes list 
-        this->cell_nodes[current_node].next = this->free_cell_nodes;
-        this->free_cell_nodes = current_node;
-    }
+        this->order_query();
 
-    template<class T, int CellSize, size_t ZBitWidth>
-    requires (ZBitWidth <= sizeof(size_t)*8)
-    inline void grid<T, CellSize, ZBitWidth>::cell_query(int cell_node) {
-        int current_node{this->cell_nodes[cell_node].next};
+        std::span query_span{last_query.begin(), this->query_size};
 
-        while (current_node != -1) {
-            assert(current_node < this->cell_nodes.size() && "current_node out of bounds");
+        std::copy(query_span.begin(), query_span.end(), std::inserter(results, results.end()));
 
-            const int current_element{this->cell_nodes[current_node].element};
+        this->reset_query_set();
 
-            // Only add to the current query if it has not already been added
-            const int condition{static_cast<int>(!this->query_set[current_element])};
-            this->last_query[this->query_size] = current_element;
+        return results;
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    template<size_t Field>
+    requires soa_elements<T>
+    std::span<const field_t<T, Field>> grid<T, CellSize, ZBitWidth, Config>::column() const {
+        return this->elements.template column<Field>();
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    template<size_t Field, typename R>
+    requires soa_elements<T> && insertable<R, field_t<T, Field>>
+    R& grid<T, CellSize, ZBitWidth, Config>::query_field(const bounds& bounds, R& results) {
+        assert(this->cell_nodes.size() > 0 && "Query attempted on uninitialized grid");
+        return this->query_field<Field>(this->get_cell_bounds(bounds), results);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    template<size_t Field, typename R>
+    requires soa_elements<T> && insertable<R, field_t<T, Field>>
+    R& grid<T, CellSize, ZBitWidth, Config>::query_field(const cell_bounds& bounds, R& results) {
+        assert(this->cell_nodes.size() > 0 && "Query attempted on uninitialized grid");
+        LIGHTGRID_TIME_OPERATION(operation::query);
+
+        for (int yy{bounds.y_start}; yy <= bounds.y_end; yy++) {
+            for (int xx{bounds.x_start}; xx <= bounds.x_end; xx++) {
+                this->cell_query(this->z_order(xx, yy), bounds, xx, yy);     
+            }
+        }
+
+        this->order_query();
+
+        std::span query_span{last_query.begin(), this->query_size};
+        const auto& column{this->elements.template column<Field>()};
+        
+        std::transform(query_span.begin(), query_span.end(), std::inserter(results, results.end()), 
+            ([&column](const auto& element) {
+                return column[element];
+            })
+        );
+
+        this->reset_query_set();
+
+        return results;
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    template<size_t Field, void VisitFunc(field_t<T, Field>, void*)>
+    requires soa_elements<T>
+    void grid<T, CellSize, ZBitWidth, Config>::visit_field(const bounds& bounds, void* user_data) {
+        assert(this->cell_nodes.size() > 0 && "Visit attempted on uninitialized grid");
+        this->visit_field<Field, VisitFunc>(this->get_cell_bounds(bounds), user_data);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    template<size_t Field, void VisitFunc(field_t<T, Field>, void*)>
+    requires soa_elements<T>
+    void grid<T, CellSize, ZBitWidth, Config>::visit_field(const cell_bounds& bounds, void* user_data) {
+        assert(this->cell_nodes.size() > 0 && "Visit attempted on uninitialized grid");
+        LIGHTGRID_TIME_OPERATION(operation::visit);
+
+        for (int yy{bounds.y_start}; yy <= bounds.y_end; yy++) {
+            for (int xx{bounds.x_start}; xx <= bounds.x_end; xx++) {
+                this->cell_query(this->z_order(xx, yy), bounds, xx, yy);     
+            }
+        }
+
+        this->order_query();
+
+        std::span query_span{last_query.begin(), this->query_size};
+        const auto& column{this->elements.template column<Field>()};
+
+        for (auto element : query_span) {
+            VisitFunc(column[element], user_data);
+        }
+
+        this->reset_query_set();
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    void grid<T, CellSize, ZBitWidth, Config>::sleep(int element_node) {
+        this->sleeping[element_node] = true;
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    void grid<T, CellSize, ZBitWidth, Config>::wake(int element_node) {
+        this->sleeping[element_node] = false;
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    bool grid<T, CellSize, ZBitWidth, Config>::is_sleeping(int element_node) const {
+        return this->sleeping[element_node];
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    template<typename Visitor>
+    requires std::invocable<Visitor&, int, element_value_t<T>>
+    void grid<T, CellSize, ZBitWidth, Config>::for_each_active(Visitor&& visitor) const {
+        for (int element_node{0}; element_node < this->sleeping.size(); element_node++) {
+            if (!this->sleeping[element_node]) {
+                visitor(element_node, this->elements[element_node]);
+            }
+        }
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    template<typename R> 
+    requires insertable<R, element_value_t<T>>
+    R& grid<T, CellSize, ZBitWidth, Config>::query_active(int element_node, const bounds& bounds, R& results) {
+        assert(this->cell_nodes.size() > 0 && "Query attempted on uninitialized grid");
+        return this->query_active(element_node, this->get_cell_bounds(bounds), results);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    template<typename R> 
+    requires insertable<R, element_value_t<T>>
+    R& grid<T, CellSize, ZBitWidth, Config>::query_active(int element_node, const cell_bounds& bounds, R& results) {
+        assert(this->cell_nodes.size() > 0 && "Query attempted on uninitialized grid");
+        LIGHTGRID_TIME_OPERATION(operation::query);
+
+        for (int yy{bounds.y_start}; yy <= bounds.y_end; yy++) {
+            for (int xx{bounds.x_start}; xx <= bounds.x_end; xx++) {
+                this->cell_query(this->z_order(xx, yy), bounds, xx, yy);     
+            }
+        }
+
+        this->filter_sleeping(element_node);
+
+        this->order_query();
+
+        std::span query_span{last_query.begin(), this->query_size};
+        
+        std::transform(query_span.begin(), query_span.end(), std::inserter(results, results.end()), 
+            ([this](const auto& element) {
+                return this->elements[element];
+            })
+        );
+
+        this->reset_query_set();
+
+        return results;
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    template<void VisitFunc(element_value_t<T>, void*)>  
+    void grid<T, CellSize, ZBitWidth, Config>::visit_active(int element_node, const bounds& bounds, void* user_data) {
+        assert(this->cell_nodes.size() > 0 && "Visit attempted on uninitialized grid");
+        this->visit_active<VisitFunc>(element_node, this->get_cell_bounds(bounds), user_data);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    template<void VisitFunc(element_value_t<T>, void*)>  
+    void grid<T, CellSize, ZBitWidth, Config>::visit_active(int element_node, const cell_bounds& bounds, void* user_data) {
+        assert(this->cell_nodes.size() > 0 && "Visit attempted on uninitialized grid");
+        LIGHTGRID_TIME_OPERATION(operation::visit);
+
+        for (int yy{bounds.y_start}; yy <= bounds.y_end; yy++) {
+            for (int xx{bounds.x_start}; xx <= bounds.x_end; xx++) {
+                this->cell_query(this->z_order(xx, yy), bounds, xx, yy);     
+            }
+        }
+
+        this->filter_sleeping(element_node);
+
+        this->order_query();
+
+        std::span query_span{last_query.begin(), this->query_size};
+
+        for (auto element : query_span) {
+            VisitFunc(this->elements[element], user_data);
+        }
+
+        this->reset_query_set();
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    inline int grid<T, CellSize, ZBitWidth, Config>::element_insert(element_value_t<T> element) {
+        // External IDs are their own element nodes
+        if constexpr (external_id_elements<T>) {
+            assert(element <= INT32_MAX && "External ID too large to be an element node");
+            return static_cast<int>(element);
+        } else {
+            int new_element_node;
+
+            if (this->free_element_nodes != -1) {
+
+                // Use the first item in the linked list and move the head to the next free node
+                new_element_node = this->free_element_nodes;
+                free_element_nodes = this->element_nodes[this->free_element_nodes].next;
+
+                this->elements[new_element_node] = element;
+
+            } else {
+
+                // Create new element node and add reference to index into elements list
+                new_element_node = this->element_nodes.size();
+                this->element_nodes.emplace_back(this->elements.size());
+                this->elements.push_back(element);
+            }
+
+            return new_element_node;
+        }
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    inline void grid<T, CellSize, ZBitWidth, Config>::element_remove(int element_node) {
+        this->sleeping[element_node] = true;
+
+        // External IDs are owned by the caller, so there is nothing to free
+        if constexpr (!external_id_elements<T>) {
+            // Make the given element_node the head of the free_element_nodes list
+            this->element_nodes[element_node].next = this->free_element_nodes;
+            this->free_element_nodes = element_node;
+        }
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    constexpr ordering grid<T, CellSize, ZBitWidth, Config>::ordering_policy() const {
+        if constexpr (runtime_ordering<Config>) {
+            return this->order;
+        } else {
+            return Config::ordering_policy;
+        }
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    constexpr dedupe grid<T, CellSize, ZBitWidth, Config>::dedupe_policy() const {
+        if constexpr (runtime_dedupe<Config>) {
+            return this->dedupe_strategy;
+        } else {
+            return Config::dedupe_policy;
+        }
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    inline void grid<T, CellSize, ZBitWidth, Config>::element_inserted(int element_node, const cell_bounds& bounds) {
+        this->num_elements++;
+
+        // External IDs may be sparse, so the per-element state must also reach the new element node
+        const size_t num_states{std::max<size_t>(this->num_elements, element_node + 1)};
+
+        // The cell queries write each element before checking whether it is a duplicate, so one spare slot is kept past
+        //      the last element found
+        if (this->query_set.size() < num_states) {
+            this->last_query.resize(num_states + 1);
+            this->query_set.resize(num_states);
+            this->sleeping.resize(num_states, true);
+        }
+
+        // Element nodes are reused, so the new element may inherit a sleeping flag
+        this->sleeping[element_node] = false;
+
+        if (this->element_bounds.size() <= element_node) {
+            this->element_bounds.resize(std::max<size_t>(this->element_nodes.size(), element_node + 1));
+        }
+
+        this->element_bounds[element_node] = bounds;
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    inline size_t grid<T, CellSize, ZBitWidth, Config>::element_node_count() const {
+        if constexpr (external_id_elements<T>) {
+            return this->element_bounds.size();
+        } else {
+            return this->element_nodes.size();
+        }
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    inline void grid<T, CellSize, ZBitWidth, Config>::cell_insert(int cell_node, int element_node) {
+        if (this->free_cell_nodes != -1) {
+
+            // Use element of free node as scratchpad for next free node
+            this->cell_nodes[this->free_cell_nodes].element = this->cell_nodes[this->free_cell_nodes].next;
+
+            // Move head of cell's linked list to the free node
+            this->cell_nodes[this->free_cell_nodes].next = this->cell_nodes[cell_node].next;
+            this->cell_nodes[cell_node].next = this->free_cell_nodes;
+
+            // Move head of free nodes to the value in scratchpad and set head of cell to the element node
+            this->free_cell_nodes = this->cell_nodes[this->free_cell_nodes].element;
+            this->cell_nodes[this->cell_nodes[cell_node].next].element = element_node;
+
+            LIGHTGRID_COUNT_EVENT(free_list_hits, 1);
+
+        } else {
+        #ifdef LIGHTGRID_EVENT_COUNTERS
+            const size_t capacity{this->cell_nodes.capacity()};
+        #endif
+
+            // Create new cell node and add reference to index into element_nodes list
+            this->cell_nodes.emplace_back(element_node, this->cell_nodes[cell_node].next);
+            this->cell_nodes[cell_node].next = this->cell_nodes.size() - 1;
+
+            LIGHTGRID_COUNT_EVENT(node_growths, 1);
+            LIGHTGRID_COUNT_EVENT(reallocations, this->cell_nodes.capacity() != capacity);
+        }
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    inline void grid<T, CellSize, ZBitWidth, Config>::cell_remove(int cell_node, int element_node) {
+        int previous_node{-1};
+        int current_node{cell_node};
+
+        // Find the element_node in the cell_node's list
+        do {
+            if (current_node == -1 /** || this->cell_nodes[current_node].element == -1/***/) {
+                return;
+            }
+            previous_node = current_node;
+            current_node = this->cell_nodes[current_node].next;
+
+            LIGHTGRID_COUNT_EVENT(remove_nodes_visited, 1);
+        }
+        while (this->cell_nodes[current_node].element != element_node);
+
+        // Remove the cell_node containing element_node
+        this->cell_nodes[previous_node].next = this->cell_nodes[current_node].next;
+        // Make the currentNode the head of the free_cell_nodes list 
+        this->cell_nodes[current_node].next = this->free_cell_nodes;
+        this->free_cell_nodes = current_node;
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    inline void grid<T, CellSize, ZBitWidth, Config>::cell_query(int cell_node) {
+        int current_node{this->cell_nodes[cell_node].next};
+
+        while (current_node != -1) {
+            assert(current_node < this->cell_nodes.size() && "current_node out of bounds");
+
+            const int current_element{this->cell_nodes[current_node].element};
+
+            // Only add to the current query if it has not already been added
+            const int condition{static_cast<int>(!this->query_set[current_element])};
+            this->last_query[this->query_size] = current_element;
             this->query_size += condition;
             this->query_set[current_element] = true;
+
+            LIGHTGRID_COUNT_EVENT(nodes_visited, 1);
+            LIGHTGRID_COUNT_EVENT(duplicates_rejected, 1 - condition);
+
             // The above is a branchless version of the following:
             // if (!this->query_set[current_element]) { 
 
@@ -481,22 +2046,390 @@ namespace lightgrid {
         }
     }
 
-    template<class T, int CellSize, size_t ZBitWidth>
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
     requires (ZBitWidth <= sizeof(size_t)*8)
-    inline cell_bounds grid<T, CellSize, ZBitWidth>::get_cell_bounds(const bounds& bounds) {
-        cell_bounds scaled;
+    inline void grid<T, CellSize, ZBitWidth, Config>::cell_query(int cell_node, const cell_bounds& bounds, int x, int y) {
+        if (this->dedupe_policy() == dedupe::visited_set) {
+            this->cell_query(cell_node);
+            return;
+        }
 
-        scaled.x_start = bounds.x/CellSize;
-        scaled.y_start = bounds.y/CellSize;
-        scaled.x_end = (bounds.x + bounds.w)/CellSize;
-        scaled.y_end = (bounds.y + bounds.h)/CellSize;
+        for (int current_node{this->cell_nodes[cell_node].next}; current_node != -1; current_node = this->cell_nodes[current_node].next) {
+            const int current_element{this->cell_nodes[current_node].element};
 
-        return scaled;
+            const int is_reference{static_cast<int>(this->is_reference_cell(current_element, bounds, x, y))};
+            this->last_query[this->query_size] = current_element;
+            this->query_size += is_reference;
+
+            LIGHTGRID_COUNT_EVENT(nodes_visited, 1);
+            LIGHTGRID_COUNT_EVENT(duplicates_rejected, 1 - is_reference);
+        }
     }
 
-    template<class T, int CellSize, size_t ZBitWidth>
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
     requires (ZBitWidth <= sizeof(size_t)*8)
-    inline void grid<T, CellSize, ZBitWidth>::reset_query_set() {
+    inline void grid<T, CellSize, ZBitWidth, Config>::cell_query(int cell_node, const cell_bounds& bounds, int x, int y, query_context& context) const {
+        const bool by_reference_point{this->dedupe_policy() == dedupe::reference_point};
+
+        for (int current_node{this->cell_nodes[cell_node].next}; current_node != -1; current_node = this->cell_nodes[current_node].next) {
+            assert(current_node < this->cell_nodes.size() && "current_node out of bounds");
+
+            const int current_element{this->cell_nodes[current_node].element};
+
+            if (by_reference_point) {
+                context.last_query[context.query_size] = current_element;
+                context.query_size += this->is_reference_cell(current_element, bounds, x, y);
+                continue;
+            }
+
+            const int condition{static_cast<int>(!context.query_set[current_element])};
+            context.last_query[context.query_size] = current_element;
+            context.query_size += condition;
+            context.query_set[current_element] = true;
+        }
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    inline bool grid<T, CellSize, ZBitWidth, Config>::is_reference_cell(int element_node, const cell_bounds& bounds, int x, int y) const {
+        const cell_bounds& stored{this->element_bounds[element_node]};
+        const int reference_y{std::max(bounds.y_start, stored.y_start)};
+
+        // Shapes may not cover the first cell of their bounds, so the first covered cell in the bounds is found from their rows
+        if (!this->element_spans.empty() && element_node < this->element_spans.size() && !this->element_spans[element_node].empty()) {
+            if (y < stored.y_start || y > stored.y_end) {
+                return false;
+            }
+
+            const list<cell_span>& spans{this->element_spans[element_node]};
+
+            if (x != std::max(bounds.x_start, spans[y - stored.y_start].x_start)) {
+                return false;
+            }
+
+            // The rows of a convex shape which reach the columns of the bounds are contiguous, so only the row above is checked
+            const cell_span* above{y > reference_y ? &spans[y - 1 - stored.y_start] : nullptr};
+            return above == nullptr || above->x_end < bounds.x_start || above->x_start > bounds.x_end;
+        }
+
+        // Elements from other cells wrapping onto this one never have their reference cell here
+        return x == std::max(bounds.x_start, stored.x_start) && y == reference_y;
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    inline void grid<T, CellSize, ZBitWidth, Config>::filter_sleeping(int element_node) {
+        if (this->sleeping[element_node]) {
+
+            // Pairs where both elements are asleep are skipped, so only awake elements are kept
+            size_t active_size{0};
+
+            for (int i{0}; i < this->query_size; i++) {
+                const int current_element{this->last_query[i]};
+
+                if (this->sleeping[current_element]) {
+                    // Removed elements will not be seen by reset_query_set
+                    this->query_set[current_element] = false;
+                } else {
+                    this->last_query[active_size] = current_element;
+                    active_size++;
+                }
+            }
+
+            this->query_size = active_size;
+
+        } else {
+
+            // Sleeping elements touched by an awake element are woken. The queried bounds may be padded beyond the
+            //      element, so only those whose stored cells overlap its own are touching
+            const cell_bounds& querier{this->element_bounds[element_node]};
+
+            for (int i{0}; i < this->query_size; i++) {
+                const int current_element{this->last_query[i]};
+                const cell_bounds& stored{this->element_bounds[current_element]};
+
+                if (stored.x_start <= querier.x_end && stored.x_end >= querier.x_start &&
+                    stored.y_start <= querier.y_end && stored.y_end >= querier.y_start) {
+                    this->sleeping[current_element] = false;
+                }
+            }
+        }
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    inline cell_bounds grid<T, CellSize, ZBitWidth, Config>::get_cell_bounds(const bounds& bounds) const {
+        return detail::get_cell_bounds<CellSize>(bounds);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    inline cell_bounds grid<T, CellSize, ZBitWidth, Config>::get_swept_cell_bounds(const bounds& bounds, const motion& motion) {
+        const float offset_x{motion.velocity_x*motion.horizon};
+        const float offset_y{motion.velocity_y*motion.horizon};
+
+        // Union of the bounds at the start and end of the horizon
+        const int x_start{std::min(bounds.x, static_cast<int>(std::floor(bounds.x + offset_x)))};
+        const int y_start{std::min(bounds.y, static_cast<int>(std::floor(bounds.y + offset_y)))};
+        const int x_end{std::max(bounds.x + bounds.w, static_cast<int>(std::ceil(bounds.x + bounds.w + offset_x)))};
+        const int y_end{std::max(bounds.y + bounds.h, static_cast<int>(std::ceil(bounds.y + bounds.h + offset_y)))};
+
+        return this->get_cell_bounds({x_start, y_start, x_end - x_start, y_end - y_start});
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    template<typename S>
+    int grid<T, CellSize, ZBitWidth, Config>::shape_insert(element_value_t<T> element, const S& shape) {
+        LIGHTGRID_TIME_OPERATION(operation::insert);
+
+        cell_bounds bounds;
+        this->rasterise(shape, bounds, this->span_scratch);
+
+        const int new_element_node{this->element_insert(element)};
+
+        for (int row{0}; row < this->span_scratch.size(); row++) {
+            for (int xx{this->span_scratch[row].x_start}; xx <= this->span_scratch[row].x_end; xx++) {
+                this->cell_insert(this->z_order(xx, bounds.y_start + row), new_element_node);
+            }
+        }
+
+        this->element_inserted(new_element_node, bounds);
+
+        if (this->element_spans.size() < this->element_bounds.size()) {
+            this->element_spans.resize(this->element_bounds.size());
+        }
+
+        this->element_spans[new_element_node] = this->span_scratch;
+
+        return new_element_node;
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    template<typename S>
+    void grid<T, CellSize, ZBitWidth, Config>::shape_remove(int element_node, const S& shape) {
+        LIGHTGRID_TIME_OPERATION(operation::remove);
+
+        cell_bounds bounds;
+        this->rasterise(shape, bounds, this->span_scratch);
+
+        for (int row{0}; row < this->span_scratch.size(); row++) {
+            for (int xx{this->span_scratch[row].x_start}; xx <= this->span_scratch[row].x_end; xx++) {
+                this->cell_remove(this->z_order(xx, bounds.y_start + row), element_node);
+            }
+        }
+
+        this->forget_spans(element_node);
+        this->element_remove(element_node);
+        this->num_elements--;
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    template<typename S>
+    void grid<T, CellSize, ZBitWidth, Config>::shape_update(int element_node, const S& old_shape, const S& new_shape) {
+        LIGHTGRID_TIME_OPERATION(operation::update);
+
+        cell_bounds bounds;
+        this->rasterise(old_shape, bounds, this->span_scratch);
+
+        for (int row{0}; row < this->span_scratch.size(); row++) {
+            for (int xx{this->span_scratch[row].x_start}; xx <= this->span_scratch[row].x_end; xx++) {
+                this->cell_remove(this->z_order(xx, bounds.y_start + row), element_node);
+            }
+        }
+
+        if (this->element_spans.size() < this->element_bounds.size()) {
+            this->element_spans.resize(this->element_bounds.size());
+        }
+
+        // The new spans replace the element's own, reusing their storage
+        list<cell_span>& spans{this->element_spans[element_node]};
+        this->rasterise(new_shape, bounds, spans);
+
+        for (int row{0}; row < spans.size(); row++) {
+            for (int xx{spans[row].x_start}; xx <= spans[row].x_end; xx++) {
+                this->cell_insert(this->z_order(xx, bounds.y_start + row), element_node);
+            }
+        }
+
+        this->element_bounds[element_node] = bounds;
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    inline void grid<T, CellSize, ZBitWidth, Config>::forget_spans(int element_node) {
+        if (element_node < this->element_spans.size()) {
+            this->element_spans[element_node].clear();
+        }
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    void grid<T, CellSize, ZBitWidth, Config>::rasterise(const circle& shape, cell_bounds& bounds, list<cell_span>& spans) const {
+        const float y_min{shape.y - shape.radius};
+        const float y_max{shape.y + shape.radius};
+
+        bounds = {INT_MAX, INT_MIN, static_cast<int>(std::floor(y_min/CellSize)), static_cast<int>(std::floor(y_max/CellSize))};
+        spans.clear();
+
+        for (int row{bounds.y_start}; row <= bounds.y_end; row++) {
+            const float band_end{std::min(static_cast<float>((row + 1)*CellSize), y_max)};
+            const float band_start{std::min(std::max(static_cast<float>(row*CellSize), y_min), band_end)};
+
+            // The circle is widest within the row at the height nearest its centre
+            const float offset{std::clamp(shape.y, band_start, band_end) - shape.y};
+            const float half_width{std::sqrt(std::max(shape.radius*shape.radius - offset*offset, 0.0f))};
+
+            this->add_span(shape.x - half_width, shape.x + half_width, bounds, spans);
+        }
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    void grid<T, CellSize, ZBitWidth, Config>::rasterise(const oriented_box& shape, cell_bounds& bounds, list<cell_span>& spans) const {
+        const float cos_angle{std::cos(shape.angle)};
+        const float sin_angle{std::sin(shape.angle)};
+
+        // Half of each side of the box, rotated
+        const float width_x{cos_angle*shape.half_width}, width_y{sin_angle*shape.half_width};
+        const float height_x{-sin_angle*shape.half_height}, height_y{cos_angle*shape.half_height};
+
+        const std::array<vertex, 4> vertices{{
+            {shape.x - width_x - height_x, shape.y - width_y - height_y},
+            {shape.x + width_x - height_x, shape.y + width_y - height_y},
+            {shape.x + width_x + height_x, shape.y + width_y + height_y},
+            {shape.x - width_x + height_x, shape.y - width_y + height_y}
+        }};
+
+        this->rasterise_polygon(vertices, bounds, spans);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    void grid<T, CellSize, ZBitWidth, Config>::rasterise(const segment& shape, cell_bounds& bounds, list<cell_span>& spans) const {
+        const std::array<vertex, 2> vertices{{{shape.x_start, shape.y_start}, {shape.x_end, shape.y_end}}};
+        this->rasterise_polygon(vertices, bounds, spans);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    void grid<T, CellSize, ZBitWidth, Config>::rasterise_polygon(std::span<const vertex> vertices, cell_bounds& bounds, list<cell_span>& spans) const {
+        float y_min{vertices[0].y};
+        float y_max{vertices[0].y};
+
+        for (const auto& corner : vertices) {
+            y_min = std::min(y_min, corner.y);
+            y_max = std::max(y_max, corner.y);
+        }
+
+        bounds = {INT_MAX, INT_MIN, static_cast<int>(std::floor(y_min/CellSize)), static_cast<int>(std::floor(y_max/CellSize))};
+        spans.clear();
+
+        for (int row{bounds.y_start}; row <= bounds.y_end; row++) {
+            const float band_end{std::min(static_cast<float>((row + 1)*CellSize), y_max)};
+            const float band_start{std::min(std::max(static_cast<float>(row*CellSize), y_min), band_end)};
+
+            float x_min{INFINITY};
+            float x_max{-INFINITY};
+
+            // A convex polygon is widest within the row where its edges cross the top or bottom of the row, or at a corner
+            //      within the row, so each edge is clipped to the row
+            for (size_t it{0}; it < vertices.size(); it++) {
+                const vertex& from{vertices[it]};
+                const vertex& to{vertices[(it + 1) % vertices.size()]};
+
+                if (std::max(from.y, to.y) < band_start || std::min(from.y, to.y) > band_end) {
+                    continue;
+                }
+
+                if (from.y == to.y) {
+                    x_min = std::min({x_min, from.x, to.x});
+                    x_max = std::max({x_max, from.x, to.x});
+                    continue;
+                }
+
+                for (const float y : {std::clamp(from.y, band_start, band_end), std::clamp(to.y, band_start, band_end)}) {
+                    const float x{from.x + (to.x - from.x)*(y - from.y)/(to.y - from.y)};
+
+                    x_min = std::min(x_min, x);
+                    x_max = std::max(x_max, x);
+                }
+            }
+
+            this->add_span(x_min, x_max, bounds, spans);
+        }
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    inline void grid<T, CellSize, ZBitWidth, Config>::add_span(float x_min, float x_max, cell_bounds& bounds, list<cell_span>& spans) const {
+        const cell_span span{static_cast<int>(std::floor(x_min/CellSize)), static_cast<int>(std::floor(x_max/CellSize))};
+
+        bounds.x_start = std::min(bounds.x_start, span.x_start);
+        bounds.x_end = std::max(bounds.x_end, span.x_end);
+
+        spans.push_back(span);
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    inline void grid<T, CellSize, ZBitWidth, Config>::order_query() {
+        if (this->ordering_policy() == ordering::by_element_node) {
+            this->sort_elements({this->last_query.begin(), this->query_size}, this->sort_scratch);
+        }
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    inline void grid<T, CellSize, ZBitWidth, Config>::sort_elements(std::span<int> elements, list<int>& scratch) const {
+        // Most queries only return a handful of elements, where an insertion sort is cheapest
+        if (elements.size() <= 32) {
+            for (size_t it{1}; it < elements.size(); it++) {
+                const int element{elements[it]};
+                size_t position{it};
+
+                for (; position > 0 && elements[position - 1] > element; position--) {
+                    elements[position] = elements[position - 1];
+                }
+
+                elements[position] = element;
+            }
+
+            return;
+        }
+
+        // Otherwise, an LSD radix sort with only as many passes as there are bytes in the largest element node
+        scratch.resize(elements.size());
+
+        std::span<int> source{elements};
+        std::span<int> destination{scratch.begin(), elements.size()};
+
+        for (uint32_t shift{0}; shift < 32 && (this->element_node_count() >> shift) > 0; shift += 8) {
+            std::array<size_t, 257> digit_offsets{};
+
+            for (auto element : source) {
+                digit_offsets[((static_cast<uint32_t>(element) >> shift) & 0xff) + 1]++;
+            }
+            for (size_t digit{1}; digit < digit_offsets.size(); digit++) {
+                digit_offsets[digit] += digit_offsets[digit - 1];
+            }
+            for (auto element : source) {
+                destination[digit_offsets[(static_cast<uint32_t>(element) >> shift) & 0xff]++] = element;
+            }
+
+            std::swap(source, destination);
+        }
+
+        if (source.data() != elements.data()) {
+            std::copy(source.begin(), source.end(), elements.begin());
+        }
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    inline void grid<T, CellSize, ZBitWidth, Config>::reset_query_set() {
         for (int i{0}; i < this->query_size; i++) {
             this->query_set[this->last_query[i]] = false;
         }
@@ -504,15 +2437,25 @@ namespace lightgrid {
         this->query_size = 0;
     }
 
-    template<class T, int CellSize, size_t ZBitWidth>
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
     requires (ZBitWidth <= sizeof(size_t)*8)
-    inline uint64_t grid<T, CellSize, ZBitWidth>::z_order(uint32_t x, uint32_t y) const {
-        return this->interleave(x, y) & wrapping_bit_mask;
+    inline uint64_t grid<T, CellSize, ZBitWidth, Config>::z_order(uint32_t x, uint32_t y) const {
+        return detail::z_order(x, y, wrapping_bit_mask);
     }
 
-    template<class T, int CellSize, size_t ZBitWidth>
-    requires (ZBitWidth <= sizeof(size_t)*8)
-    inline uint64_t grid<T, CellSize, ZBitWidth>::interleave_with_zeros(uint32_t input) const {
+    template<int CellSize>
+    inline cell_bounds detail::get_cell_bounds(const bounds& bounds) {
+        cell_bounds scaled;
+
+        scaled.x_start = bounds.x/CellSize;
+        scaled.y_start = bounds.y/CellSize;
+        scaled.x_end = (bounds.x + bounds.w)/CellSize;
+        scaled.y_end = (bounds.y + bounds.h)/CellSize;
+
+        return scaled;
+    }
+
+    inline uint64_t detail::interleave_with_zeros(uint32_t input) {
         uint64_t res = input;
         res = (res | (res << 16)) & 0x0000ffff0000ffff;
         res = (res | (res << 8 )) & 0x00ff00ff00ff00ff;
@@ -522,23 +2465,317 @@ namespace lightgrid {
         return res;
     }
 
+    inline uint64_t detail::z_order(uint32_t x, uint32_t y, uint64_t wrapping_bit_mask) {
+        return interleave(x, y) & wrapping_bit_mask;
+    }
+
     #define PDEP_AVAILABLE (defined(__BMI2__) && (defined(__GNUC__) || defined(__llvm__)) && defined(__x86_64__))
 
     // In the case that _pdep_u64 is unavailable, use a traditional algorithm for interleaving
     #if !PDEP_AVAILABLE
-        template<class T, int CellSize, size_t ZBitWidth>
-        requires (ZBitWidth <= sizeof(size_t)*8)
-        inline uint64_t grid<T, CellSize, ZBitWidth>::interleave(uint32_t x, uint32_t y) const {
-            return this->interleave_with_zeros(x) | (this->interleave_with_zeros(y) << 1);
+        inline uint64_t detail::interleave(uint32_t x, uint32_t y) {
+            return interleave_with_zeros(x) | (interleave_with_zeros(y) << 1);
         }
     #endif
 
     #if PDEP_AVAILABLE
-        template<class T, int CellSize, size_t ZBitWidth>
-        requires (ZBitWidth <= sizeof(size_t)*8)
         __attribute__ ((target ("bmi2")))
-        inline uint64_t grid<T, CellSize, ZBitWidth>::interleave(uint32_t x, uint32_t y) const {
+        inline uint64_t detail::interleave(uint32_t x, uint32_t y) {
             return _pdep_u64(y,0xaaaaaaaaaaaaaaaa) | _pdep_u64(x, 0x5555555555555555);
         }
     #endif
+
+    #define AVX512_AVAILABLE (defined(__AVX512F__) && (defined(__GNUC__) || defined(__llvm__)) && defined(__x86_64__))
+    #define AVX2_AVAILABLE (defined(__AVX2__) && (defined(__GNUC__) || defined(__llvm__)) && defined(__x86_64__))
+
+#ifdef LIGHTGRID_EVENT_COUNTERS
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    event_counters grid<T, CellSize, ZBitWidth, Config>::counters() const {
+        return this->events;
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    void grid<T, CellSize, ZBitWidth, Config>::reset_counters() {
+        this->events = {};
+    }
+#endif
+
+#ifdef LIGHTGRID_LATENCY_HISTOGRAMS
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    const latency_histogram& grid<T, CellSize, ZBitWidth, Config>::latency(operation op) const {
+        return this->latencies[static_cast<size_t>(op)];
+    }
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    void grid<T, CellSize, ZBitWidth, Config>::reset_latencies() {
+        for (auto& histogram : this->latencies) {
+            histogram.reset();
+        }
+    }
+
+    inline latency_histogram::latency_histogram(const latency_histogram& other) {
+        *this = other;
+    }
+
+    inline latency_histogram& latency_histogram::operator=(const latency_histogram& other) {
+        for (int it{0}; it < num_buckets; it++) {
+            this->buckets[it].store(other.buckets[it].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+
+        this->total_count.store(other.total_count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        this->total_latency.store(other.total_latency.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        this->max_latency.store(other.max_latency.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+        return *this;
+    }
+
+    inline void latency_histogram::record(uint64_t latency) {
+        this->buckets[bucket(latency)].fetch_add(1, std::memory_order_relaxed);
+        this->total_count.fetch_add(1, std::memory_order_relaxed);
+        this->total_latency.fetch_add(latency, std::memory_order_relaxed);
+
+        uint64_t current_max{this->max_latency.load(std::memory_order_relaxed)};
+        while (latency > current_max && !this->max_latency.compare_exchange_weak(current_max, latency, std::memory_order_relaxed));
+    }
+
+    inline void latency_histogram::reset() {
+        for (auto& bucket : this->buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+
+        this->total_count.store(0, std::memory_order_relaxed);
+        this->total_latency.store(0, std::memory_order_relaxed);
+        this->max_latency.store(0, std::memory_order_relaxed);
+    }
+
+    inline uint64_t latency_histogram::count() const {
+        return this->total_count.load(std::memory_order_relaxed);
+    }
+
+    inline uint64_t latency_histogram::max() const {
+        return this->max_latency.load(std::memory_order_relaxed);
+    }
+
+    inline double latency_histogram::mean() const {
+        const uint64_t count{this->count()};
+        return count ? this->total_latency.load(std::memory_order_relaxed)/static_cast<double>(count) : 0.0;
+    }
+
+    inline uint64_t latency_histogram::percentile(double fraction) const {
+        const uint64_t target = std::ceil(std::clamp(fraction, 0.0, 1.0)*this->count());
+        uint64_t seen{0};
+
+        for (int it{0}; it < num_buckets; it++) {
+            seen += this->buckets[it].load(std::memory_order_relaxed);
+
+            if (seen >= target && seen > 0) {
+                return std::min(bucket_upper_bound(it), this->max());
+            }
+        }
+
+        return this->max();
+    }
+
+    inline int latency_histogram::bucket(uint64_t latency) {
+        // Values below the number of sub-buckets are recorded exactly
+        if (latency < sub_buckets) {
+            return latency;
+        }
+
+        const int exponent{63 - __builtin_clzll(latency)};
+        const int sub_bucket = (latency >> (exponent - sub_bucket_bits)) & (sub_buckets - 1);
+
+        return (exponent - sub_bucket_bits + 1)*sub_buckets + sub_bucket;
+    }
+
+    inline uint64_t latency_histogram::bucket_upper_bound(int bucket) {
+        if (bucket < sub_buckets) {
+            return bucket;
+        }
+
+        const int exponent{bucket/sub_buckets + sub_bucket_bits - 1};
+        const uint64_t sub_bucket = bucket % sub_buckets;
+
+        return ((sub_buckets + sub_bucket + 1) << (exponent - sub_bucket_bits)) - 1;
+    }
+
+    inline latency_timer::latency_timer(latency_histogram& histogram) : histogram{ histogram }, start{ now() } {}
+
+    inline latency_timer::~latency_timer() {
+        this->histogram.record(now() - this->start);
+    }
+
+    inline uint64_t latency_timer::now() {
+    #if defined(LIGHTGRID_LATENCY_RDTSC) && defined(__x86_64__)
+        return __rdtsc();
+    #else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    #endif
+    }
+#endif
+
+    template<class T, int CellSize, size_t ZBitWidth, class Config>
+    requires (ZBitWidth <= sizeof(size_t)*8)
+    void grid<T, CellSize, ZBitWidth, Config>::z_order_batch(std::span<const uint32_t> xs, std::span<const uint32_t> ys, std::span<uint64_t> out) const {
+        assert(xs.size() == ys.size() && xs.size() == out.size() && "Mismatched z_order_batch spans");
+
+        size_t it{0};
+
+        #if AVX2_AVAILABLE
+            // Only the low 16 bits of each coordinate can reach a z-order of 32 bits or less, so 8 pairs fit in 32-bit lanes
+            if constexpr (ZBitWidth <= 32) {
+                // Each of the low two coordinate bytes is duplicated, split into its low and high nibble, and each nibble
+                //      is spread to the even bits of a byte through a shuffle lookup
+                const __m256i duplicate_bytes{_mm256_setr_epi8(
+                    0, 0, 1, 1, 4, 4, 5, 5, 8, 8, 9, 9, 12, 12, 13, 13,
+                    0, 0, 1, 1, 4, 4, 5, 5, 8, 8, 9, 9, 12, 12, 13, 13
+                )};
+                const __m256i spread_nibble{_mm256_setr_epi8(
+                    0x00, 0x01, 0x04, 0x05, 0x10, 0x11, 0x14, 0x15, 0x40, 0x41, 0x44, 0x45, 0x50, 0x51, 0x54, 0x55,
+                    0x00, 0x01, 0x04, 0x05, 0x10, 0x11, 0x14, 0x15, 0x40, 0x41, 0x44, 0x45, 0x50, 0x51, 0x54, 0x55
+                )};
+                const __m256i odd_bytes{_mm256_set1_epi16(static_cast<short>(0xff00))};
+                const __m256i low_nibbles{_mm256_set1_epi8(0x0f)};
+                const __m256i mask{_mm256_set1_epi32(static_cast<uint32_t>(wrapping_bit_mask))};
+
+                const auto interleave_with_zeros = [&](__m256i input) {
+                    const __m256i bytes{_mm256_shuffle_epi8(input, duplicate_bytes)};
+                    const __m256i low{_mm256_and_si256(bytes, low_nibbles)};
+                    const __m256i high{_mm256_and_si256(_mm256_srli_epi16(bytes, 4), low_nibbles)};
+
+                    return _mm256_shuffle_epi8(spread_nibble, _mm256_blendv_epi8(low, high, odd_bytes));
+                };
+
+                for (; it + 8 <= xs.size(); it += 8) {
+                    const __m256i x{interleave_with_zeros(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(xs.data() + it)))};
+                    const __m256i y{interleave_with_zeros(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ys.data() + it)))};
+
+                    const __m256i z{_mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi32(y, 1)), mask)};
+
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out.data() + it), _mm256_cvtepu32_epi64(_mm256_castsi256_si128(z)));
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out.data() + it + 4), _mm256_cvtepu32_epi64(_mm256_extracti128_si256(z, 1)));
+                }
+            }
+        #endif
+
+        for (; it < xs.size(); it++) {
+            out[it] = this->z_order(xs[it], ys[it]);
+        }
+    }
+
+    #if !AVX512_AVAILABLE && AVX2_AVAILABLE
+        // Permutations moving the lanes set in an 8-bit mask to the front of a vector, used to compact AVX2 results
+        inline constexpr auto compact_permutations{[] {
+            std::array<std::array<int, 8>, 256> permutations{};
+
+            for (int mask{0}; mask < 256; mask++) {
+                int kept{0};
+
+                for (int lane{0}; lane < 8; lane++) {
+                    if (mask & (1 << lane)) {
+                        permutations[mask][kept] = lane;
+                        kept++;
+                    }
+                }
+            }
+
+            return permutations;
+        }()};
+    #endif
+
+    inline size_t filter_overlapping(const bounds& bounds, const bounds_columns& columns, std::span<int> candidates) {
+        const int right{bounds.x + bounds.w};
+        const int bottom{bounds.y + bounds.h};
+
+        size_t kept{0};
+        size_t it{0};
+
+        // Lanes are stored no further forward than where they were read from, so compacting in place is safe
+
+        #if AVX512_AVAILABLE
+            const __m512i query_x{_mm512_set1_epi32(bounds.x)};
+            const __m512i query_y{_mm512_set1_epi32(bounds.y)};
+            const __m512i query_right{_mm512_set1_epi32(right)};
+            const __m512i query_bottom{_mm512_set1_epi32(bottom)};
+
+            for (; it + 16 <= candidates.size(); it += 16) {
+                const __m512i indices{_mm512_loadu_si512(candidates.data() + it)};
+
+                const __m512i x{_mm512_i32gather_epi32(indices, columns.x.data(), 4)};
+                const __m512i y{_mm512_i32gather_epi32(indices, columns.y.data(), 4)};
+                const __m512i w{_mm512_i32gather_epi32(indices, columns.w.data(), 4)};
+                const __m512i h{_mm512_i32gather_epi32(indices, columns.h.data(), 4)};
+
+                __mmask16 mask{_mm512_cmplt_epi32_mask(x, query_right)};
+                mask = _mm512_mask_cmplt_epi32_mask(mask, query_x, _mm512_add_epi32(x, w));
+                mask = _mm512_mask_cmplt_epi32_mask(mask, y, query_bottom);
+                mask = _mm512_mask_cmplt_epi32_mask(mask, query_y, _mm512_add_epi32(y, h));
+
+                _mm512_mask_compressstoreu_epi32(candidates.data() + kept, mask, indices);
+                kept += __builtin_popcount(mask);
+            }
+        #elif AVX2_AVAILABLE
+            const __m256i query_x{_mm256_set1_epi32(bounds.x)};
+            const __m256i query_y{_mm256_set1_epi32(bounds.y)};
+            const __m256i query_right{_mm256_set1_epi32(right)};
+            const __m256i query_bottom{_mm256_set1_epi32(bottom)};
+
+            for (; it + 8 <= candidates.size(); it += 8) {
+                const __m256i indices{_mm256_loadu_si256(reinterpret_cast<const __m256i*>(candidates.data() + it))};
+
+                const __m256i x{_mm256_i32gather_epi32(columns.x.data(), indices, 4)};
+                const __m256i y{_mm256_i32gather_epi32(columns.y.data(), indices, 4)};
+                const __m256i w{_mm256_i32gather_epi32(columns.w.data(), indices, 4)};
+                const __m256i h{_mm256_i32gather_epi32(columns.h.data(), indices, 4)};
+
+                __m256i overlap{_mm256_cmpgt_epi32(query_right, x)};
+                overlap = _mm256_and_si256(overlap, _mm256_cmpgt_epi32(_mm256_add_epi32(x, w), query_x));
+                overlap = _mm256_and_si256(overlap, _mm256_cmpgt_epi32(query_bottom, y));
+                overlap = _mm256_and_si256(overlap, _mm256_cmpgt_epi32(_mm256_add_epi32(y, h), query_y));
+
+                const int mask{_mm256_movemask_ps(_mm256_castsi256_ps(overlap))};
+                const __m256i permutation{_mm256_loadu_si256(reinterpret_cast<const __m256i*>(compact_permutations[mask].data()))};
+
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(candidates.data() + kept), _mm256_permutevar8x32_epi32(indices, permutation));
+                kept += __builtin_popcount(mask);
+            }
+        #endif
+
+        // Scalar fallback, which also handles any candidates left over from the vectorized loops
+        for (; it < candidates.size(); it++) {
+            const int candidate{candidates[it]};
+
+            const int x{columns.x[candidate]};
+            const int y{columns.y[candidate]};
+
+            const bool overlap{x < right && bounds.x < x + columns.w[candidate] && y < bottom && bounds.y < y + columns.h[candidate]};
+
+            candidates[kept] = candidate;
+            kept += overlap;
+        }
+
+        return kept;
+    }
 }
+
+// Explicitly instantiates a grid, such as LIGHTGRID_INSTANTIATE_GRID(, int, 10, 16);, along with the queries into a
+//      std::vector of its elements. With extern as the first argument, it instead declares an instantiation made elsewhere
+//      so that it isn't compiled again
+#define LIGHTGRID_INSTANTIATE_GRID(prefix, ...) \
+    prefix template class lightgrid::grid<__VA_ARGS__>; \
+    prefix template std::vector<lightgrid::grid<__VA_ARGS__>::value_type>& lightgrid::grid<__VA_ARGS__>::query(const lightgrid::bounds&, std::vector<lightgrid::grid<__VA_ARGS__>::value_type>&); \
+    prefix template std::vector<lightgrid::grid<__VA_ARGS__>::value_type>& lightgrid::grid<__VA_ARGS__>::query(const lightgrid::cell_bounds&, std::vector<lightgrid::grid<__VA_ARGS__>::value_type>&); \
+    prefix template std::vector<lightgrid::grid<__VA_ARGS__>::value_type>& lightgrid::grid<__VA_ARGS__>::query(const lightgrid::bounds&, std::vector<lightgrid::grid<__VA_ARGS__>::value_type>&) const; \
+    prefix template std::vector<lightgrid::grid<__VA_ARGS__>::value_type>& lightgrid::grid<__VA_ARGS__>::query(const lightgrid::cell_bounds&, std::vector<lightgrid::grid<__VA_ARGS__>::value_type>&) const; \
+    prefix template std::vector<lightgrid::grid<__VA_ARGS__>::value_type>& lightgrid::grid<__VA_ARGS__>::query(const lightgrid::bounds&, std::vector<lightgrid::grid<__VA_ARGS__>::value_type>&, lightgrid::grid<__VA_ARGS__>::query_context&) const; \
+    prefix template std::vector<lightgrid::grid<__VA_ARGS__>::value_type>& lightgrid::grid<__VA_ARGS__>::query(const lightgrid::cell_bounds&, std::vector<lightgrid::grid<__VA_ARGS__>::value_type>&, lightgrid::grid<__VA_ARGS__>::query_context&) const
+
+// Defined by the lightgrid::lightgrid target, which compiles the grids listed in LIGHTGRID_INSTANTIATIONS once for every
+//      translation unit linking it
+#ifdef LIGHTGRID_EXTERN_TEMPLATES
+    #include <lightgrid/instantiations.hpp>
+#endif
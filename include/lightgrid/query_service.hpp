@@ -0,0 +1,280 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "grid.hpp"
+
+namespace lightgrid {
+
+    /**
+    * Answers queries on a grid from any number of threads without the callers locking the grid
+    *
+    *   Requests are pushed onto a lock-free queue and answered by a single worker thread, which drains the queue in
+    *   batches sorted by the z-order of each request's first cell, so that consecutive queries walk nearby cells.
+    *   Results are returned through a std::future or passed to a callback on the worker thread.
+    *   The grid must only be changed through modify() while the service exists.
+    */
+    template<class Grid>
+    class query_service {
+    public:
+        using value_type = typename Grid::value_type;
+        using results_type = std::vector<value_type>;
+        using callback_type = std::function<void(results_type&&)>;
+
+        explicit query_service(const Grid& grid, size_t max_batch_size=1024);
+        ~query_service();
+
+        query_service(const query_service&) = delete;
+        query_service& operator=(const query_service&) = delete;
+
+        std::future<results_type> query(const bounds& bounds);
+        std::future<results_type> query(const cell_bounds& bounds);
+        // The callback is run on the worker thread, so it should be quick
+        void query(const bounds& bounds, callback_type callback);
+        void query(const cell_bounds& bounds, callback_type callback);
+
+        // Runs the given function while no batch is being answered, so that it may change the grid
+        template<typename F>
+        void modify(F&& modify_grid);
+
+    private:
+        struct request {
+            std::atomic<request*> next{nullptr};
+            cell_bounds bounds;
+            std::promise<results_type> promise;
+            callback_type callback; // Used instead of the promise if set
+        };
+
+        void push(request* new_request);
+        // Links a request onto the head of the queue without waking the worker
+        void link(request* new_request);
+        request* pop();
+
+        void work();
+        void answer(std::vector<std::unique_ptr<request>>& requests);
+
+        const Grid& grid;
+        const size_t max_batch_size;
+
+        // Intrusive multi-producer single-consumer queue. Producers link new requests at the head, while the worker
+        //      follows the next pointers from the tail. The stub keeps the queue from ever being empty
+        request stub;
+        std::atomic<request*> head{&stub};
+        request* tail{&stub};
+
+        // Incremented after every push, which the worker waits on when the queue is empty
+        std::atomic<uint64_t> submitted{0};
+        std::atomic<bool> stopping{false};
+
+        std::mutex grid_mutex; // Only held by the worker while a batch is answered, and by modify()
+
+        // Reused between batches to avoid reallocation
+        typename Grid::query_context context;
+        std::vector<uint32_t> xs, ys;
+        std::vector<uint64_t> z;
+        std::vector<std::pair<uint64_t, size_t>> order;
+        std::vector<results_type> results;
+
+        std::thread worker; // Last, so that everything it uses is constructed before it starts
+    };
+
+    template<class Grid>
+    query_service<Grid>::query_service(const Grid& grid, size_t max_batch_size) :
+        grid{grid}, max_batch_size{max_batch_size}, worker{&query_service::work, this} {
+        assert(max_batch_size > 0 && "Query service batches must hold at least one request");
+    }
+
+    template<class Grid>
+    query_service<Grid>::~query_service() {
+        this->stopping.store(true, std::memory_order_release);
+        this->submitted.fetch_add(1, std::memory_order_release);
+        this->submitted.notify_one();
+
+        this->worker.join();
+    }
+
+    template<class Grid>
+    std::future<typename query_service<Grid>::results_type> query_service<Grid>::query(const bounds& bounds) {
+        return this->query(this->grid.get_cell_bounds(bounds));
+    }
+
+    template<class Grid>
+    std::future<typename query_service<Grid>::results_type> query_service<Grid>::query(const cell_bounds& bounds) {
+        assert(!this->stopping.load(std::memory_order_relaxed) && "Query made on a stopped query service");
+
+        request* new_request{new request{}};
+        new_request->bounds = bounds;
+
+        std::future<results_type> future{new_request->promise.get_future()};
+        this->push(new_request);
+
+        return future;
+    }
+
+    template<class Grid>
+    void query_service<Grid>::query(const bounds& bounds, callback_type callback) {
+        this->query(this->grid.get_cell_bounds(bounds), std::move(callback));
+    }
+
+    template<class Grid>
+    void query_service<Grid>::query(const cell_bounds& bounds, callback_type callback) {
+        assert(!this->stopping.load(std::memory_order_relaxed) && "Query made on a stopped query service");
+        assert(callback && "Query made with an empty callback");
+
+        request* new_request{new request{}};
+        new_request->bounds = bounds;
+        new_request->callback = std::move(callback);
+
+        this->push(new_request);
+    }
+
+    template<class Grid>
+    template<typename F>
+    void query_service<Grid>::modify(F&& modify_grid) {
+        std::lock_guard lock{this->grid_mutex};
+        modify_grid();
+    }
+
+    template<class Grid>
+    void query_service<Grid>::push(request* new_request) {
+        this->link(new_request);
+
+        this->submitted.fetch_add(1, std::memory_order_release);
+        this->submitted.notify_one();
+    }
+
+    template<class Grid>
+    void query_service<Grid>::link(request* new_request) {
+        new_request->next.store(nullptr, std::memory_order_relaxed);
+
+        // Between the exchange and the store, the request is in the queue but can't be reached from the tail yet.
+        //      The worker treats this as empty, and sees it once submitted changes
+        request* previous{this->head.exchange(new_request, std::memory_order_acq_rel)};
+        previous->next.store(new_request, std::memory_order_release);
+    }
+
+    template<class Grid>
+    typename query_service<Grid>::request* query_service<Grid>::pop() {
+        request* current{this->tail};
+        request* next{current->next.load(std::memory_order_acquire)};
+
+        // Skip over the stub
+        if (current == &this->stub) {
+            if (next == nullptr) {
+                return nullptr;
+            }
+
+            this->tail = next;
+            current = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+
+        if (next != nullptr) {
+            this->tail = next;
+            return current;
+        }
+
+        // The last request can only be taken once something is behind it, so the stub is put back in
+        if (current != this->head.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+
+        // Only the worker puts the stub back, so there is no one to wake
+        this->link(&this->stub);
+        next = current->next.load(std::memory_order_acquire);
+
+        if (next != nullptr) {
+            this->tail = next;
+            return current;
+        }
+
+        return nullptr;
+    }
+
+    template<class Grid>
+    void query_service<Grid>::work() {
+        std::vector<std::unique_ptr<request>> requests;
+
+        while (true) {
+            const uint64_t seen{this->submitted.load(std::memory_order_acquire)};
+            const bool stop{this->stopping.load(std::memory_order_acquire)};
+
+            while (true) {
+                requests.clear();
+
+                for (request* next{this->pop()}; next != nullptr; next = this->pop()) {
+                    requests.emplace_back(next);
+
+                    if (requests.size() == this->max_batch_size) {
+                        break;
+                    }
+                }
+
+                if (requests.empty()) {
+                    break;
+                }
+
+                this->answer(requests);
+            }
+
+            // Requests made before stopping have all been answered
+            if (stop) {
+                return;
+            }
+
+            this->submitted.wait(seen, std::memory_order_acquire);
+        }
+    }
+
+    template<class Grid>
+    void query_service<Grid>::answer(std::vector<std::unique_ptr<request>>& requests) {
+        const size_t num_requests{requests.size()};
+
+        this->xs.resize(num_requests);
+        this->ys.resize(num_requests);
+        this->z.resize(num_requests);
+        this->order.resize(num_requests);
+        this->results.resize(num_requests);
+
+        for (size_t it{0}; it < num_requests; it++) {
+            this->xs[it] = requests[it]->bounds.x_start;
+            this->ys[it] = requests[it]->bounds.y_start;
+        }
+
+        this->grid.z_order_batch(this->xs, this->ys, this->z);
+
+        for (size_t it{0}; it < num_requests; it++) {
+            this->order[it] = {this->z[it], it};
+        }
+
+        std::sort(this->order.begin(), this->order.end());
+
+        {
+            std::lock_guard lock{this->grid_mutex};
+
+            for (auto [z, index] : this->order) {
+                this->results[index].clear();
+                this->grid.query(requests[index]->bounds, this->results[index], this->context);
+            }
+        }
+
+        // Completed outside of the lock, as callbacks may take a while
+        for (size_t it{0}; it < num_requests; it++) {
+            if (requests[it]->callback) {
+                requests[it]->callback(std::move(this->results[it]));
+            } else {
+                requests[it]->promise.set_value(std::move(this->results[it]));
+            }
+        }
+    }
+}
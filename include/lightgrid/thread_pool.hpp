@@ -0,0 +1,223 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+namespace lightgrid {
+
+    /**
+    * @brief Fork-join pool which runs a number of independent tasks, such as the tiles of grid::parallel_visit.
+    *   Each worker is given an even share of the tasks, which it takes from the front of. Once a worker runs out,
+    *   it steals the back half of whichever other worker has the most left, so uneven tasks are still balanced.
+    *   The calling thread takes part as worker 0, so a pool of size 1 has no threads of its own.
+    */
+    class thread_pool {
+    public:
+        explicit thread_pool(size_t num_workers=std::thread::hardware_concurrency());
+        ~thread_pool();
+
+        thread_pool(const thread_pool&) = delete;
+        thread_pool& operator=(const thread_pool&) = delete;
+
+        size_t size() const;
+
+        // Runs task(index) for every index below num_tasks, returning once all have finished.
+        //      Only one run may be in progress at a time
+        void run(size_t num_tasks, const std::function<void(size_t)>& task);
+
+    private:
+        // Each worker's remaining tasks, packed as (begin << 32) | end so that both can be changed at once
+        struct alignas(64) task_range {
+            std::atomic<uint64_t> range{0};
+        };
+
+        static uint64_t pack(uint32_t begin, uint32_t end);
+
+        bool take(size_t worker, size_t& task);
+        bool steal(size_t thief);
+        void work_until_done(size_t worker);
+        void work(size_t worker);
+
+        std::vector<task_range> ranges;
+
+        const std::function<void(size_t)>* task{nullptr};
+        std::atomic<size_t> remaining{0}; // Tasks not yet finished
+
+        std::mutex mutex;
+        std::condition_variable run_ready;
+        std::condition_variable run_done;
+        uint64_t generation{0};
+        size_t active_workers{0};
+        bool stopping{false};
+
+        std::vector<std::thread> threads; // Last, so that everything they use is constructed before they start
+    };
+
+    inline thread_pool::thread_pool(size_t num_workers) : ranges(std::max<size_t>(num_workers, 1)) {
+        for (size_t worker{1}; worker < this->ranges.size(); worker++) {
+            this->threads.emplace_back(&thread_pool::work, this, worker);
+        }
+    }
+
+    inline thread_pool::~thread_pool() {
+        {
+            std::lock_guard lock{this->mutex};
+            this->stopping = true;
+        }
+
+        this->run_ready.notify_all();
+
+        for (auto& thread : this->threads) {
+            thread.join();
+        }
+    }
+
+    inline size_t thread_pool::size() const {
+        return this->ranges.size();
+    }
+
+    inline void thread_pool::run(size_t num_tasks, const std::function<void(size_t)>& task) {
+        assert(num_tasks <= UINT32_MAX && "Too many tasks given to thread pool");
+
+        if (num_tasks == 0) {
+            return;
+        }
+
+        const size_t num_workers{this->ranges.size()};
+
+        for (size_t worker{0}; worker < num_workers; worker++) {
+            this->ranges[worker].range.store(pack(num_tasks*worker/num_workers, num_tasks*(worker + 1)/num_workers), std::memory_order_relaxed);
+        }
+
+        this->task = &task;
+        this->remaining.store(num_tasks, std::memory_order_relaxed);
+
+        {
+            std::lock_guard lock{this->mutex};
+            this->active_workers = this->threads.size();
+            this->generation++;
+        }
+
+        this->run_ready.notify_all();
+
+        this->work_until_done(0);
+
+        // The other workers may still be looking for work to steal, and must stop before the next run changes the ranges
+        std::unique_lock lock{this->mutex};
+        this->run_done.wait(lock, [this] { return this->active_workers == 0; });
+    }
+
+    inline uint64_t thread_pool::pack(uint32_t begin, uint32_t end) {
+        return (static_cast<uint64_t>(begin) << 32) | end;
+    }
+
+    inline bool thread_pool::take(size_t worker, size_t& task) {
+        std::atomic<uint64_t>& range{this->ranges[worker].range};
+        uint64_t current{range.load(std::memory_order_acquire)};
+
+        while (true) {
+            const uint32_t begin = current >> 32;
+            const uint32_t end = current;
+
+            if (begin >= end) {
+                return false;
+            }
+
+            if (range.compare_exchange_weak(current, pack(begin + 1, end), std::memory_order_acq_rel)) {
+                task = begin;
+                return true;
+            }
+        }
+    }
+
+    inline bool thread_pool::steal(size_t thief) {
+        const size_t num_workers{this->ranges.size()};
+
+        // Steal from the worker with the most tasks left, so that fewer steals are needed
+        size_t victim{thief};
+        uint32_t most_left{0};
+
+        for (size_t worker{0}; worker < num_workers; worker++) {
+            const uint64_t current{this->ranges[worker].range.load(std::memory_order_relaxed)};
+            const uint32_t begin = current >> 32;
+            const uint32_t end = current;
+
+            if (worker != thief && end > begin && end - begin > most_left) {
+                victim = worker;
+                most_left = end - begin;
+            }
+        }
+
+        if (victim == thief) {
+            return false;
+        }
+
+        std::atomic<uint64_t>& range{this->ranges[victim].range};
+        uint64_t current{range.load(std::memory_order_acquire)};
+
+        while (true) {
+            const uint32_t begin = current >> 32;
+            const uint32_t end = current;
+
+            if (begin >= end) {
+                // Another worker got there first, but there may be more to steal elsewhere
+                return true;
+            }
+
+            // The victim keeps the first half, as it is taking tasks from the front
+            const uint32_t middle{begin + (end - begin)/2};
+
+            if (range.compare_exchange_weak(current, pack(begin, middle), std::memory_order_acq_rel)) {
+                // Only the thief takes from its own range while it is empty, so it can simply be replaced
+                this->ranges[thief].range.store(pack(middle, end), std::memory_order_release);
+                return true;
+            }
+        }
+    }
+
+    inline void thread_pool::work_until_done(size_t worker) {
+        size_t task;
+
+        while (this->remaining.load(std::memory_order_acquire) > 0) {
+            if (this->take(worker, task)) {
+                (*this->task)(task);
+                this->remaining.fetch_sub(1, std::memory_order_acq_rel);
+            } else if (!this->steal(worker)) {
+                // Nothing is left to steal, only tasks which are still running
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    inline void thread_pool::work(size_t worker) {
+        uint64_t last_generation{0};
+
+        while (true) {
+            {
+                std::unique_lock lock{this->mutex};
+                this->run_ready.wait(lock, [&] { return this->stopping || this->generation != last_generation; });
+
+                if (this->stopping) {
+                    return;
+                }
+
+                last_generation = this->generation;
+            }
+
+            this->work_until_done(worker);
+
+            std::lock_guard lock{this->mutex};
+
+            if (--this->active_workers == 0) {
+                this->run_done.notify_one();
+            }
+        }
+    }
+}
@@ -0,0 +1,60 @@
+module;
+
+#include <lightgrid/grid.hpp>
+#include <lightgrid/thread_pool.hpp>
+#include <lightgrid/query_service.hpp>
+#include <lightgrid/concurrent_grid.hpp>
+
+export module lightgrid;
+
+// Macros such as PDEP_AVAILABLE and the instrumentation switches aren't exported, so the grid is configured by the
+//      definitions given when building the module
+export namespace lightgrid {
+    using lightgrid::insertable;
+    using lightgrid::task_pool;
+
+    using lightgrid::bounds;
+    using lightgrid::cell_bounds;
+    using lightgrid::point;
+    using lightgrid::motion;
+    using lightgrid::circle;
+    using lightgrid::oriented_box;
+    using lightgrid::segment;
+
+    using lightgrid::ordering;
+    using lightgrid::dedupe;
+    using lightgrid::runtime_policy;
+    using lightgrid::config;
+    using lightgrid::default_config;
+    using lightgrid::runtime_dedupe;
+    using lightgrid::runtime_ordering;
+
+#ifdef LIGHTGRID_LATENCY_HISTOGRAMS
+    using lightgrid::operation;
+    using lightgrid::latency_histogram;
+#endif
+
+#ifdef LIGHTGRID_EVENT_COUNTERS
+    using lightgrid::event_counters;
+#endif
+
+    using lightgrid::soa;
+    using lightgrid::soa_vector;
+    using lightgrid::external_ids;
+    using lightgrid::id_list;
+    using lightgrid::element_storage;
+    using lightgrid::element_value_t;
+    using lightgrid::external_id_elements;
+    using lightgrid::soa_elements;
+    using lightgrid::field_t;
+
+    using lightgrid::bounds_columns;
+    using lightgrid::filter_overlapping;
+
+    using lightgrid::chunk_generator;
+
+    using lightgrid::grid;
+    using lightgrid::concurrent_grid;
+    using lightgrid::query_service;
+    using lightgrid::thread_pool;
+}
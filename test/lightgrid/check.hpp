@@ -0,0 +1,39 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+
+namespace lightgrid_test {
+    struct test_case {
+        const char* name;
+        void(*run)();
+    };
+
+    inline std::vector<test_case>& tests() {
+        static std::vector<test_case> registered;
+        return registered;
+    }
+
+    inline int failures{0};
+
+    struct registrar {
+        registrar(const char* name, void(*run)()) {
+            tests().push_back({name, run});
+        }
+    };
+}
+
+// Defines a test which is run by the test executable
+#define TEST(name) \
+    static void name(); \
+    static lightgrid_test::registrar name##_registrar{#name, name}; \
+    static void name()
+
+// Reports a failed condition without stopping the test, so every failure in a run is seen
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            lightgrid_test::failures++; \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed\n"; \
+        } \
+    } while (false)
@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include <lightgrid/concurrent_grid.hpp>
+
+#include "check.hpp"
+
+namespace {
+    using test_grid = lightgrid::concurrent_grid<int, 10>;
+
+    struct live_element {
+        int node;
+        int value;
+        lightgrid::bounds bounds;
+    };
+
+    // Kept within the 256 cells each way of the default width, so that no cells wrap
+    lightgrid::bounds random_bounds(uint32_t& state) {
+        const auto next = [&](uint32_t range) {
+            state = state*1664525u + 1013904223u;
+            return static_cast<int>((state >> 8) % range);
+        };
+
+        return {next(2200), next(2200), next(120), next(120)};
+    }
+
+    bool has_duplicates(std::vector<int> values) {
+        std::sort(values.begin(), values.end());
+        return std::adjacent_find(values.begin(), values.end()) != values.end();
+    }
+}
+
+TEST(concurrent_grid_stress) {
+    test_grid grid;
+
+    constexpr int num_threads{4};
+    constexpr int operations_per_thread{5000};
+
+    std::vector<std::vector<live_element>> live(num_threads);
+    std::vector<int> failures(num_threads, 0);
+    std::vector<std::thread> threads;
+
+    for (int thread{0}; thread < num_threads; thread++) {
+        threads.emplace_back([&, thread] {
+            test_grid::node_pool pool{grid.make_pool()};
+            std::vector<live_element>& owned{live[thread]};
+            std::vector<int> results;
+            uint32_t state{static_cast<uint32_t>(thread + 1)};
+            int next_value{thread*operations_per_thread};
+
+            for (int it{0}; it < operations_per_thread; it++) {
+                const uint32_t choice{(state >> 16) % 4};
+                const lightgrid::bounds bounds{random_bounds(state)};
+
+                if (choice == 0 || owned.empty()) {
+                    owned.push_back({grid.insert(pool, next_value, bounds), next_value, bounds});
+                    next_value++;
+                } else if (choice == 1) {
+                    const size_t index{state % owned.size()};
+                    grid.remove(pool, owned[index].node, owned[index].bounds);
+                    owned[index] = owned.back();
+                    owned.pop_back();
+                } else if (choice == 2) {
+                    live_element& moved{owned[state % owned.size()]};
+                    grid.update(pool, moved.node, moved.bounds, bounds);
+                    moved.bounds = bounds;
+                } else {
+                    // Only this thread changes its own elements, so one of them must always be found where it was put
+                    const live_element& found{owned[state % owned.size()]};
+                    results.clear();
+                    grid.query(found.bounds, results);
+
+                    failures[thread] += std::find(results.begin(), results.end(), found.value) == results.end();
+                    failures[thread] += has_duplicates(results);
+                }
+            }
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (int thread{0}; thread < num_threads; thread++) {
+        CHECK(failures[thread] == 0);
+    }
+
+    std::vector<int> expected;
+
+    for (const auto& owned : live) {
+        for (const live_element& element : owned) {
+            expected.push_back(element.value);
+        }
+    }
+
+    std::vector<int> results;
+    grid.query(lightgrid::bounds{0, 0, 2500, 2500}, results);
+
+    std::sort(expected.begin(), expected.end());
+    std::sort(results.begin(), results.end());
+    CHECK(results == expected);
+}
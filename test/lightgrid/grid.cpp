@@ -1,5 +1,873 @@
-#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <utility>
+#include <vector>
 
-int main() {
-    std::cout << "There are currently no tests\n";
-}
\ No newline at end of file
+#include <lightgrid/grid.hpp>
+
+#include "check.hpp"
+
+namespace {
+    using test_grid = lightgrid::grid<int, 10>;
+
+    template<typename Grid>
+    std::vector<int> sorted_query(Grid& grid, const lightgrid::bounds& bounds) {
+        std::vector<int> results;
+        grid.query(bounds, results);
+        std::sort(results.begin(), results.end());
+        return results;
+    }
+}
+
+TEST(clear_resets_per_element_state) {
+    test_grid grid;
+
+    const int first{grid.insert(1, lightgrid::bounds{0, 0, 30, 30})};
+    const int second{grid.insert(2, lightgrid::bounds{100, 100, 5, 5})};
+    grid.sleep(second);
+    grid.remove(first, lightgrid::bounds{0, 0, 30, 30});
+
+    grid.clear();
+
+    // Freed nodes from before the clear must not be reused
+    const int third{grid.insert(3, lightgrid::bounds{0, 0, 30, 30})};
+    CHECK(third == 0);
+    CHECK(!grid.is_sleeping(third));
+    CHECK(sorted_query(grid, {0, 0, 200, 200}) == std::vector<int>{3});
+
+    const int fourth{grid.insert(4, lightgrid::bounds{100, 100, 5, 5})};
+    CHECK(fourth == 1);
+    CHECK(!grid.is_sleeping(fourth));
+    CHECK((sorted_query(grid, {0, 0, 200, 200}) == std::vector<int>{3, 4}));
+}
+
+TEST(sleeping_pairs_are_skipped) {
+    test_grid grid;
+
+    const int sleeper{grid.insert(1, lightgrid::bounds{0, 0, 5, 5})};
+    const int other_sleeper{grid.insert(2, lightgrid::bounds{2, 2, 5, 5})};
+    grid.insert(3, lightgrid::bounds{4, 4, 5, 5});
+    grid.sleep(sleeper);
+    grid.sleep(other_sleeper);
+
+    std::vector<int> results;
+    grid.query_active(sleeper, lightgrid::bounds{0, 0, 10, 10}, results);
+    std::sort(results.begin(), results.end());
+    CHECK(results == std::vector<int>{3});
+
+    // A sleeping querier never wakes anything
+    CHECK(grid.is_sleeping(other_sleeper));
+
+    // The skipped elements must not be left marked by the query
+    CHECK((sorted_query(grid, {0, 0, 10, 10}) == std::vector<int>{1, 2, 3}));
+}
+
+TEST(awake_querier_wakes_only_touching_elements) {
+    test_grid grid;
+
+    const int querier{grid.insert(1, lightgrid::bounds{0, 0, 5, 5})};
+    const int touching{grid.insert(2, lightgrid::bounds{3, 3, 4, 4})};
+    const int nearby{grid.insert(3, lightgrid::bounds{12, 0, 5, 5})};
+    grid.sleep(touching);
+    grid.sleep(nearby);
+
+    // Padded bounds find both, but only the element sharing a cell with the querier is touching it
+    std::vector<int> results;
+    grid.query_active(querier, lightgrid::bounds{0, 0, 25, 25}, results);
+    std::sort(results.begin(), results.end());
+    CHECK((results == std::vector<int>{1, 2, 3}));
+    CHECK(!grid.is_sleeping(touching));
+    CHECK(grid.is_sleeping(nearby));
+
+    const int far{grid.insert(4, lightgrid::bounds{100, 100, 5, 5})};
+    grid.remove(querier);
+    grid.sleep(far);
+
+    // Removed and sleeping elements are not active
+    std::vector<std::pair<int, int>> active;
+    grid.for_each_active([&](int element_node, int element) {
+        active.emplace_back(element_node, element);
+    });
+    CHECK((active == std::vector<std::pair<int, int>>{{touching, 2}}));
+
+    grid.wake(far);
+    const int reused{grid.insert(5, lightgrid::bounds{200, 200, 5, 5})};
+    active.clear();
+    grid.for_each_active([&](int element_node, int element) {
+        active.emplace_back(element_node, element);
+    });
+    CHECK((active == std::vector<std::pair<int, int>>{{reused, 5}, {touching, 2}, {far, 4}}));
+}
+
+TEST(motion_update_uses_stored_cells) {
+    test_grid grid;
+    const lightgrid::motion still{0.0f, 0.0f, 1.0f};
+
+    // Elements inserted without a motion are treated as expired, so are always reinserted
+    const int plain{grid.insert(1, lightgrid::bounds{0, 0, 5, 5})};
+    CHECK(grid.update(plain, lightgrid::bounds{200, 200, 5, 5}, still, 0.0f));
+    CHECK(sorted_query(grid, {0, 0, 20, 20}).empty());
+    CHECK(sorted_query(grid, {190, 190, 30, 30}) == std::vector<int>{1});
+
+    // Without velocity, the swept cells are those of the bounds, so a plain update can be given them
+    const int predicted{grid.insert(2, lightgrid::bounds{400, 0, 5, 5}, still, 0.0f)};
+    grid.update(predicted, lightgrid::bounds{400, 0, 5, 5}, lightgrid::bounds{600, 600, 5, 5});
+    CHECK(sorted_query(grid, {390, 0, 30, 20}).empty());
+
+    // Removal must use the cells of the plain update, not those swept by the motion
+    grid.remove(predicted);
+    CHECK(sorted_query(grid, {590, 590, 30, 30}).empty());
+
+    const lightgrid::motion moving{10.0f, 0.0f, 5.0f};
+    const int swept{grid.insert(3, lightgrid::bounds{0, 400, 5, 5}, moving, 0.0f)};
+    CHECK(sorted_query(grid, {45, 400, 5, 5}) == std::vector<int>{3});
+    CHECK(!grid.update(swept, lightgrid::bounds{20, 400, 5, 5}, moving, 2.0f));
+    CHECK(grid.update(swept, lightgrid::bounds{20, 400, 5, 5}, moving, 6.0f));
+    CHECK(sorted_query(grid, {0, 400, 10, 5}).empty());
+
+    grid.remove(swept);
+    grid.remove(plain);
+    CHECK(sorted_query(grid, {0, 0, 1000, 1000}).empty());
+}
+
+TEST(reorder_by_space_keeps_elements) {
+    test_grid grid;
+    std::vector<int> nodes;
+
+    for (int it{0}; it < 200; it++) {
+        // Scattered so that the z-order differs from the insertion order
+        const int x{(it*7919) % 900};
+        const int y{(it*104729) % 900};
+        nodes.push_back(grid.insert(it, lightgrid::bounds{x, y, it % 30, it % 25}));
+    }
+
+    const lightgrid::motion moving{5.0f, 5.0f, 10.0f};
+    const int predicted{grid.insert(1000, lightgrid::bounds{50, 50, 5, 5}, moving, 0.0f)};
+    const lightgrid::circle circle{450.0f, 450.0f, 40.0f};
+    const int shape{grid.insert(1001, circle)};
+
+    for (int it{0}; it < 200; it += 3) {
+        const int x{(it*7919) % 900};
+        const int y{(it*104729) % 900};
+        grid.remove(nodes[it], lightgrid::bounds{x, y, it % 30, it % 25});
+    }
+
+    for (int it{1}; it < 200; it += 3) {
+        grid.sleep(nodes[it]);
+    }
+
+    const std::vector<int> before{sorted_query(grid, {0, 0, 1000, 1000})};
+    const std::vector<int> remap{grid.reorder_by_space()};
+
+    CHECK(sorted_query(grid, {0, 0, 1000, 1000}) == before);
+
+    for (int it{0}; it < 200; it++) {
+        if (it % 3 == 0) {
+            CHECK(remap[nodes[it]] == -1);
+        } else {
+            CHECK(remap[nodes[it]] != -1);
+            CHECK(grid.is_sleeping(remap[nodes[it]]) == (it % 3 == 1));
+        }
+    }
+
+    // The prediction followed the element, so it is still within its horizon
+    CHECK(!grid.update(remap[predicted], lightgrid::bounds{55, 55, 5, 5}, moving, 1.0f));
+
+    // As did the stored cells and the spans of the shape, which are needed to report elements once by reference point
+    //      and to remove them
+    grid.set_dedupe(lightgrid::dedupe::reference_point);
+    CHECK(sorted_query(grid, {0, 0, 1000, 1000}) == before);
+
+    const std::vector<int> around_shape{sorted_query(grid, {400, 400, 100, 100})};
+    CHECK(std::count(around_shape.begin(), around_shape.end(), 1001) == 1);
+    CHECK(around_shape == sorted_query(std::as_const(grid), {400, 400, 100, 100}));
+
+    grid.remove(remap[predicted]);
+    grid.remove(remap[shape]);
+    const std::vector<int> after_remove{sorted_query(grid, {0, 0, 1000, 1000})};
+    CHECK(std::count(after_remove.begin(), after_remove.end(), 1000) == 0);
+    CHECK(std::count(after_remove.begin(), after_remove.end(), 1001) == 0);
+}
+
+TEST(soa_columns_stay_aligned) {
+    lightgrid::grid<lightgrid::soa<int, float>, 10> grid;
+    std::vector<int> nodes;
+
+    for (int it{0}; it < 100; it++) {
+        const lightgrid::bounds bounds{(it*53) % 500, (it*29) % 500, 5 + it % 20, 5};
+        nodes.push_back(grid.insert({it, it*0.5f}, bounds));
+    }
+
+    const auto columns_aligned = [&grid]() {
+        const auto ids{grid.column<0>()};
+        const auto halves{grid.column<1>()};
+
+        std::vector<int> live;
+        grid.query_nodes(lightgrid::bounds{0, 0, 600, 600}, live);
+
+        for (auto element_node : live) {
+            if (halves[element_node] != ids[element_node]*0.5f) {
+                return false;
+            }
+        }
+
+        return true;
+    };
+
+    const auto query_ids = [&grid](const lightgrid::bounds& bounds) {
+        std::vector<int> ids;
+        grid.query_field<0>(bounds, ids);
+        std::sort(ids.begin(), ids.end());
+        return ids;
+    };
+
+    CHECK(columns_aligned());
+    CHECK(query_ids({0, 0, 600, 600}).size() == 100);
+
+    // Every other element is removed, and its freed node reused by a new element
+    for (int it{0}; it < 100; it += 2) {
+        grid.remove(nodes[it]);
+    }
+
+    nodes[0] = grid.insert({1000, 500.0f}, lightgrid::bounds{250, 250, 5, 5});
+    CHECK(columns_aligned());
+
+    std::vector<int> expected;
+    for (int it{1}; it < 100; it += 2) {
+        expected.push_back(it);
+    }
+    expected.push_back(1000);
+    CHECK(query_ids({0, 0, 600, 600}) == expected);
+
+    std::vector<float> halves;
+    grid.query_field<1>(lightgrid::bounds{250, 250, 5, 5}, halves);
+    CHECK(std::find(halves.begin(), halves.end(), 500.0f) != halves.end());
+
+    // The columns are permuted together, so every field still belongs to the same element
+    const std::vector<int> remap{grid.reorder_by_space()};
+    CHECK(columns_aligned());
+    CHECK(query_ids({0, 0, 600, 600}) == expected);
+    CHECK(grid.column<0>()[remap[nodes[0]]] == 1000);
+    CHECK(grid.column<1>()[remap[nodes[0]]] == 500.0f);
+}
+
+TEST(filter_overlapping_matches_scalar) {
+    std::mt19937 rng{80};
+    std::uniform_int_distribution<int> position{-200, 200};
+    std::uniform_int_distribution<int> size{0, 60};
+
+    std::vector<int> x(1000), y(1000), w(1000), h(1000);
+    for (size_t it{0}; it < x.size(); it++) {
+        x[it] = position(rng);
+        y[it] = position(rng);
+        w[it] = size(rng);
+        h[it] = size(rng);
+    }
+
+    const lightgrid::bounds_columns columns{x, y, w, h};
+
+    const auto scalar_filter = [&](const lightgrid::bounds& bounds, const std::vector<int>& candidates) {
+        std::vector<int> kept;
+        std::copy_if(candidates.begin(), candidates.end(), std::back_inserter(kept), [&](int candidate) {
+            return x[candidate] < bounds.x + bounds.w && bounds.x < x[candidate] + w[candidate] &&
+                y[candidate] < bounds.y + bounds.h && bounds.y < y[candidate] + h[candidate];
+        });
+        return kept;
+    };
+
+    std::vector<int> indices(x.size());
+    std::iota(indices.begin(), indices.end(), 0);
+
+    // Lengths either side of the 8 and 16 lane widths, so the scalar tail is also run after the vector loops
+    for (size_t length : {0, 1, 7, 9, 15, 17, 31, 33, 100, 257, 1000}) {
+        for (int it{0}; it < 8; it++) {
+            std::shuffle(indices.begin(), indices.end(), rng);
+            const std::vector<int> candidates(indices.begin(), indices.begin() + length);
+
+            const lightgrid::bounds queried{position(rng), position(rng), size(rng)*2, size(rng)*2};
+            const lightgrid::bounds everything{-1000, -1000, 2000, 2000};
+            const lightgrid::bounds nothing{5000, 5000, 10, 10};
+
+            for (const auto& bounds : {queried, everything, nothing}) {
+                std::vector<int> filtered{candidates};
+                const size_t kept{lightgrid::filter_overlapping(bounds, columns, filtered)};
+                filtered.resize(kept);
+
+                CHECK(filtered == scalar_filter(bounds, candidates));
+            }
+
+            std::vector<int> all_kept{candidates};
+            CHECK(lightgrid::filter_overlapping(everything, columns, all_kept) == length);
+            CHECK(all_kept == candidates);
+
+            std::vector<int> none_kept{candidates};
+            CHECK(lightgrid::filter_overlapping(nothing, columns, none_kept) == 0);
+        }
+    }
+}
+
+namespace {
+    template<size_t ZBitWidth>
+    bool z_order_batch_matches_scalar(std::mt19937& rng) {
+        const lightgrid::grid<int, 10, ZBitWidth> grid;
+        const uint64_t mask{(uint64_t{1} << ZBitWidth) - 1};
+
+        // Coordinates over the whole range wrap the mask, and those just past 16 bits must still be masked correctly
+        std::uniform_int_distribution<uint32_t> coordinate{0, UINT32_MAX};
+        const std::vector<uint32_t> edges{0, 1, 0xff, 0x100, 0xffff, 0x10000, 0x1ffff, UINT32_MAX};
+
+        for (size_t length : {0, 1, 7, 9, 15, 17, 100, 259}) {
+            std::vector<uint32_t> xs(length), ys(length);
+
+            for (size_t it{0}; it < length; it++) {
+                xs[it] = it < edges.size() ? edges[it] : coordinate(rng);
+                ys[it] = it < edges.size() ? edges[edges.size() - 1 - it] : coordinate(rng);
+            }
+
+            std::vector<uint64_t> batched(length);
+            grid.z_order_batch(xs, ys, batched);
+
+            for (size_t it{0}; it < length; it++) {
+                if (batched[it] != lightgrid::detail::z_order(xs[it], ys[it], mask)) {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+}
+
+TEST(z_order_batch_matches_scalar) {
+    std::mt19937 rng{81};
+
+    CHECK(z_order_batch_matches_scalar<16>(rng));
+    CHECK(z_order_batch_matches_scalar<21>(rng));
+    CHECK(z_order_batch_matches_scalar<8>(rng));
+}
+
+TEST(query_points_match_point_queries) {
+    test_grid grid;
+    std::mt19937 rng{82};
+    std::uniform_int_distribution<int> position{0, 400};
+    std::uniform_int_distribution<int> size{1, 40};
+
+    for (int it{0}; it < 150; it++) {
+        grid.insert(it, lightgrid::bounds{position(rng), position(rng), size(rng), size(rng)});
+    }
+
+    std::vector<lightgrid::point> points;
+    for (int it{0}; it < 100; it++) {
+        points.push_back({position(rng), position(rng)});
+    }
+
+    // Repeated points, distinct points sharing a cell, and a point with nothing around it
+    points.push_back(points[3]);
+    points.push_back(points[3]);
+    points.push_back({points[10].x - points[10].x % 10, points[10].y - points[10].y % 10});
+    points.push_back({points[10].x - points[10].x % 10 + 9, points[10].y - points[10].y % 10 + 9});
+    points.push_back({2000, 2000});
+    std::shuffle(points.begin(), points.end(), rng);
+
+    std::vector<int> results;
+    std::vector<size_t> offsets;
+    grid.query_points(points, results, offsets);
+
+    CHECK(offsets.size() == points.size() + 1);
+    CHECK(offsets.front() == 0 && offsets.back() == results.size());
+
+    bool saw_empty{false};
+
+    for (size_t it{0}; it < points.size(); it++) {
+        std::vector<int> batched(results.begin() + offsets[it], results.begin() + offsets[it + 1]);
+        std::sort(batched.begin(), batched.end());
+
+        std::vector<int> expected;
+        grid.query(points[it].x, points[it].y, expected);
+        std::sort(expected.begin(), expected.end());
+
+        CHECK(batched == expected);
+        saw_empty = saw_empty || batched.empty();
+    }
+
+    CHECK(saw_empty);
+
+    grid.query_points({}, results, offsets);
+    CHECK(results.empty());
+    CHECK(offsets == std::vector<size_t>{0});
+}
+
+TEST(ordered_queries_ignore_history) {
+    std::vector<lightgrid::bounds> inserted;
+
+    for (int it{0}; it < 600; it++) {
+        inserted.push_back(lightgrid::bounds{(it*7919) % 500, (it*104729) % 500, 5 + it % 30, 5 + it % 20});
+    }
+
+    // Every element keeps its element node, but the cell lists are built in different orders
+    test_grid forward;
+    test_grid backward;
+    test_grid churned;
+
+    for (int it{0}; it < inserted.size(); it++) {
+        forward.insert(it, inserted[it]);
+        backward.insert(it, inserted[it]);
+        churned.insert(it, inserted[it]);
+    }
+
+    // Removed nodes are reused last in first out, so reinserting in reverse gives each element its node back
+    for (int it{0}; it < inserted.size(); it++) {
+        backward.remove(it, inserted[it]);
+    }
+    for (int it{static_cast<int>(inserted.size()) - 1}; it >= 0; it--) {
+        CHECK(backward.insert(it, inserted[it]) == it);
+    }
+
+    for (int it{0}; it < inserted.size(); it += 3) {
+        churned.remove(it, inserted[it]);
+    }
+    for (int it{static_cast<int>(inserted.size()) - 1}; it >= 0; it--) {
+        if (it % 3 == 0) {
+            CHECK(churned.insert(it, inserted[it]) == it);
+        }
+    }
+    for (int it{1}; it < inserted.size(); it += 5) {
+        churned.update(it, inserted[it], lightgrid::bounds{1000, 1000, 5, 5});
+        churned.update(it, lightgrid::bounds{1000, 1000, 5, 5}, inserted[it]);
+    }
+
+    test_grid::query_context context;
+    bool saw_small{false};
+    bool saw_large{false};
+
+    for (auto* grid : {&forward, &backward, &churned}) {
+        grid->set_ordering(lightgrid::ordering::by_element_node);
+    }
+
+    // Small queries are sorted by insertion sort, and those returning more than 32 elements by radix sort
+    for (int it{0}; it < 60; it++) {
+        const lightgrid::bounds query{(it*6271) % 450, (it*3323) % 450, 5 + (it % 6)*40, 5 + (it % 4)*50};
+
+        std::vector<int> expected;
+        forward.query(query, expected);
+
+        CHECK(std::is_sorted(expected.begin(), expected.end()));
+        CHECK(std::adjacent_find(expected.begin(), expected.end()) == expected.end());
+
+        for (auto* grid : {&backward, &churned}) {
+            std::vector<int> results;
+            grid->query(query, results);
+            CHECK(results == expected);
+
+            std::vector<int> with_context;
+            grid->query(query, with_context, context);
+            CHECK(with_context == expected);
+        }
+
+        saw_small = saw_small || (expected.size() > 1 && expected.size() <= 32);
+        saw_large = saw_large || expected.size() > 32;
+    }
+
+    CHECK(saw_small);
+    CHECK(saw_large);
+}
+
+TEST(visit_async_chunks_match_query) {
+    test_grid grid;
+
+    for (int it{0}; it < 300; it++) {
+        grid.insert(it, lightgrid::bounds{(it*7919) % 600, (it*104729) % 600, (it % 4 == 0) ? 60 + it % 90 : it % 15, (it % 6 == 0) ? 80 : it % 12});
+    }
+
+    // Shapes only cover some of the cells of their bounds
+    grid.insert(1000, lightgrid::circle{300.0f, 300.0f, 70.0f});
+    grid.insert(1001, lightgrid::segment{20.0f, 500.0f, 400.0f, 90.0f});
+
+    for (int it{0}; it < 40; it++) {
+        const lightgrid::bounds query{(it*6271) % 650, (it*3323) % 650, (it*37) % 300, (it*53) % 250};
+        const std::vector<int> expected{sorted_query(grid, query)};
+
+        for (size_t nodes_per_chunk : {1, 3, 16, 1000}) {
+            std::vector<int> visited;
+            bool chunks_sized{true};
+
+            for (auto chunk : grid.visit_async(query, nodes_per_chunk)) {
+                chunks_sized = chunks_sized && !chunk.empty() && chunk.size() <= nodes_per_chunk;
+                visited.insert(visited.end(), chunk.begin(), chunk.end());
+            }
+
+            std::sort(visited.begin(), visited.end());
+            CHECK(chunks_sized);
+            CHECK(visited == expected);
+        }
+    }
+
+    // Nothing within the bounds gives no chunks at all
+    auto empty{grid.visit_async(lightgrid::bounds{5000, 5000, 10, 10}, 4)};
+    CHECK(!empty.next());
+}
+
+TEST(dedupe_strategies_agree) {
+    test_grid grid;
+    std::vector<lightgrid::bounds> inserted;
+
+    // From a single cell up to elements spanning dozens of cells each way, overlapping each other
+    for (int it{0}; it < 400; it++) {
+        const lightgrid::bounds bounds{(it*7919) % 1500, (it*104729) % 1500, (it % 5 == 0) ? 100 + it % 300 : it % 25, (it % 7 == 0) ? 150 + it % 250 : it % 15};
+        grid.insert(it, bounds);
+        inserted.push_back(bounds);
+    }
+
+    const lightgrid::bounds whole{0, 0, 2000, 2000};
+    test_grid::query_context context;
+
+    for (int it{0}; it < 300; it++) {
+        // Queries starting inside, ending inside, or cutting through the larger elements
+        const lightgrid::bounds query{(it*6271) % 1800, (it*3323) % 1800, (it*17) % 240, (it*29) % 200};
+        const lightgrid::cell_bounds query_cells{grid.get_cell_bounds(query)};
+
+        std::vector<int> expected;
+
+        for (int element{0}; element < inserted.size(); element++) {
+            const lightgrid::cell_bounds cells{grid.get_cell_bounds(inserted[element])};
+
+            if (cells.x_start <= query_cells.x_end && cells.x_end >= query_cells.x_start && cells.y_start <= query_cells.y_end && cells.y_end >= query_cells.y_start) {
+                expected.push_back(element);
+            }
+        }
+
+        grid.set_dedupe(lightgrid::dedupe::visited_set);
+        CHECK(sorted_query(grid, query) == expected);
+
+        std::vector<int> with_context;
+        grid.query(query, with_context, context);
+        std::sort(with_context.begin(), with_context.end());
+        CHECK(with_context == expected);
+
+        grid.set_dedupe(lightgrid::dedupe::reference_point);
+        CHECK(sorted_query(grid, query) == expected);
+
+        with_context.clear();
+        grid.query(query, with_context, context);
+        std::sort(with_context.begin(), with_context.end());
+        CHECK(with_context == expected);
+
+        const test_grid& const_grid{grid};
+        CHECK(sorted_query(const_grid, query) == expected);
+    }
+
+    // Each element is reported once by a query covering all of them
+    grid.set_dedupe(lightgrid::dedupe::reference_point);
+    CHECK(sorted_query(grid, whole).size() == inserted.size());
+}
+
+namespace {
+    // Whether the element is in the cell holding the point, through the single cell query
+    bool found_at(test_grid& grid, int element, int x, int y) {
+        std::vector<int> results;
+        grid.query(x, y, results);
+        return std::find(results.begin(), results.end(), element) != results.end();
+    }
+
+    bool inside(const lightgrid::circle& shape, float x, float y) {
+        return (x - shape.x)*(x - shape.x) + (y - shape.y)*(y - shape.y) <= shape.radius*shape.radius;
+    }
+
+    bool inside(const lightgrid::oriented_box& shape, float x, float y) {
+        // Into the frame of the box, where it is axis aligned
+        const float local_x{std::cos(shape.angle)*(x - shape.x) + std::sin(shape.angle)*(y - shape.y)};
+        const float local_y{-std::sin(shape.angle)*(x - shape.x) + std::cos(shape.angle)*(y - shape.y)};
+        return std::abs(local_x) <= shape.half_width && std::abs(local_y) <= shape.half_height;
+    }
+
+    const std::vector<lightgrid::circle> test_circles{{100.0f, 100.0f, 35.0f}, {403.5f, 251.2f, 4.0f}, {250.0f, 300.0f, 0.5f}, {615.0f, 615.0f, 60.0f}};
+    const std::vector<lightgrid::oriented_box> test_boxes{{150.0f, 150.0f, 40.0f, 10.0f, 0.0f}, {300.0f, 200.0f, 50.0f, 5.0f, 0.6f}, {500.0f, 400.0f, 25.0f, 25.0f, 0.785398f}, {700.0f, 300.0f, 80.0f, 3.0f, 2.4f}};
+    const std::vector<lightgrid::segment> test_segments{{10.0f, 10.0f, 300.0f, 120.0f}, {500.0f, 50.0f, 480.0f, 400.0f}, {200.0f, 600.0f, 600.0f, 600.0f}, {700.0f, 100.0f, 701.0f, 101.0f}};
+}
+
+TEST(shapes_cover_every_point_inside) {
+    test_grid grid;
+
+    for (const auto& shape : test_circles) {
+        const int element{grid.insert(1, shape)};
+
+        for (int y{static_cast<int>(shape.y - shape.radius)}; y <= shape.y + shape.radius; y++) {
+            for (int x{static_cast<int>(shape.x - shape.radius)}; x <= shape.x + shape.radius; x++) {
+                if (inside(shape, x, y)) {
+                    CHECK(found_at(grid, 1, x, y));
+                }
+            }
+        }
+
+        grid.remove(element, shape);
+    }
+
+    for (const auto& shape : test_boxes) {
+        const int element{grid.insert(2, shape)};
+        const float reach{shape.half_width + shape.half_height};
+
+        for (int y{static_cast<int>(shape.y - reach)}; y <= shape.y + reach; y++) {
+            for (int x{static_cast<int>(shape.x - reach)}; x <= shape.x + reach; x++) {
+                if (inside(shape, x, y)) {
+                    CHECK(found_at(grid, 2, x, y));
+                }
+            }
+        }
+
+        grid.remove(element, shape);
+    }
+
+    for (const auto& shape : test_segments) {
+        const int element{grid.insert(3, shape)};
+
+        for (int step{0}; step <= 1000; step++) {
+            const float t{step/1000.0f};
+            const float x{shape.x_start + (shape.x_end - shape.x_start)*t};
+            const float y{shape.y_start + (shape.y_end - shape.y_start)*t};
+
+            CHECK(found_at(grid, 3, static_cast<int>(x), static_cast<int>(y)));
+        }
+
+        grid.remove(element, shape);
+    }
+
+    CHECK(sorted_query(grid, {0, 0, 1000, 1000}).empty());
+}
+
+TEST(shapes_are_reported_once_by_reference_point) {
+    test_grid grid;
+    int value{0};
+
+    for (const auto& shape : test_circles) {
+        grid.insert(value++, shape);
+    }
+
+    for (const auto& shape : test_boxes) {
+        grid.insert(value++, shape);
+    }
+
+    for (const auto& shape : test_segments) {
+        grid.insert(value++, shape);
+    }
+
+    // Alongside some plain bounds, which share cells with the shapes
+    for (int it{0}; it < 20; it++) {
+        grid.insert(value++, lightgrid::bounds{it*37, it*29, 40, 25});
+    }
+
+    // Queries which cut through shapes at every offset, so that many miss the first cell of the shape's bounds
+    for (int y{0}; y < 700; y += 23) {
+        for (int x{0}; x < 700; x += 31) {
+            const lightgrid::bounds query{x, y, 15 + (x + y) % 90, 10 + (x*y) % 70};
+
+            grid.set_dedupe(lightgrid::dedupe::visited_set);
+            const std::vector<int> expected{sorted_query(grid, query)};
+
+            grid.set_dedupe(lightgrid::dedupe::reference_point);
+            const std::vector<int> by_reference{sorted_query(grid, query)};
+
+            const test_grid& const_grid{grid};
+            CHECK(by_reference == expected);
+            CHECK(sorted_query(const_grid, query) == expected);
+        }
+    }
+}
+
+namespace {
+    // After moving an element from one shape to another, it must be in exactly the cells of the new shape
+    template<typename Shape>
+    bool update_matches_insert(const Shape& old_shape, const Shape& new_shape) {
+        test_grid updated;
+        test_grid inserted;
+
+        const int element{updated.insert(1, old_shape)};
+        updated.update(element, old_shape, new_shape);
+        inserted.insert(1, new_shape);
+
+        for (int y{5}; y < 1000; y += 10) {
+            for (int x{5}; x < 1000; x += 10) {
+                if (found_at(updated, 1, x, y) != found_at(inserted, 1, x, y)) {
+                    return false;
+                }
+            }
+        }
+
+        // No cells were left behind that a removal would miss
+        updated.remove(element, new_shape);
+        return sorted_query(updated, {0, 0, 1000, 1000}).empty();
+    }
+}
+
+TEST(shape_update_removes_old_cells) {
+    for (size_t it{0}; it < test_circles.size(); it++) {
+        const size_t next{(it + 1) % test_circles.size()};
+
+        CHECK(update_matches_insert(test_circles[it], test_circles[next]));
+
+        // Overlapping, so that some cells are both removed from and inserted into
+        const lightgrid::circle nudged{test_circles[it].x + 13.0f, test_circles[it].y - 7.0f, test_circles[it].radius*0.7f};
+        CHECK(update_matches_insert(test_circles[it], nudged));
+    }
+
+    for (size_t it{0}; it < test_boxes.size(); it++) {
+        const size_t next{(it + 1) % test_boxes.size()};
+
+        CHECK(update_matches_insert(test_boxes[it], test_boxes[next]));
+
+        lightgrid::oriented_box rotated{test_boxes[it]};
+        rotated.angle += 1.1f;
+        CHECK(update_matches_insert(test_boxes[it], rotated));
+    }
+
+    for (size_t it{0}; it < test_segments.size(); it++) {
+        const size_t next{(it + 1) % test_segments.size()};
+
+        CHECK(update_matches_insert(test_segments[it], test_segments[next]));
+
+        const lightgrid::segment reversed{test_segments[it].x_end, test_segments[it].y_end, test_segments[it].x_start + 20.0f, test_segments[it].y_start};
+        CHECK(update_matches_insert(test_segments[it], reversed));
+    }
+}
+
+TEST(external_ids_are_element_nodes) {
+    lightgrid::grid<lightgrid::external_ids, 10> grid;
+
+    const auto query_ids = [&grid](const lightgrid::bounds& bounds) {
+        std::vector<uint32_t> ids;
+        grid.query(bounds, ids);
+        std::sort(ids.begin(), ids.end());
+        return ids;
+    };
+
+    // Sparse IDs, inserted out of order, are returned as their own element nodes
+    CHECK(grid.insert(700u, lightgrid::bounds{0, 0, 25, 25}) == 700);
+    CHECK(grid.insert(3u, lightgrid::bounds{10, 10, 5, 5}) == 3);
+    CHECK(grid.insert(4000u, lightgrid::bounds{100, 100, 5, 5}) == 4000);
+    CHECK(grid.insert(41u, lightgrid::bounds{300, 300, 50, 50}) == 41);
+
+    CHECK((query_ids({0, 0, 20, 20}) == std::vector<uint32_t>{3, 700}));
+    CHECK((query_ids({0, 0, 400, 400}) == std::vector<uint32_t>{3, 41, 700, 4000}));
+    CHECK(query_ids({500, 500, 50, 50}).empty());
+
+    // By the given bounds, and by the cells stored for the ID
+    grid.remove(3, lightgrid::bounds{10, 10, 5, 5});
+    grid.remove(700);
+
+    CHECK(query_ids({0, 0, 20, 20}).empty());
+    CHECK((query_ids({0, 0, 400, 400}) == std::vector<uint32_t>{41, 4000}));
+
+    // A removed ID can be inserted again elsewhere
+    CHECK(grid.insert(700u, lightgrid::bounds{200, 0, 5, 5}) == 700);
+    CHECK((query_ids({195, 0, 10, 10}) == std::vector<uint32_t>{700}));
+    CHECK(query_ids({0, 0, 20, 20}).empty());
+
+    grid.update(700, lightgrid::bounds{200, 0, 5, 5}, lightgrid::bounds{100, 100, 5, 5});
+    CHECK((query_ids({95, 95, 10, 10}) == std::vector<uint32_t>{700, 4000}));
+
+    // IDs which were never inserted, or have been removed, are not active
+    std::vector<int> active;
+    grid.for_each_active([&](int element_node, uint32_t id) {
+        CHECK(element_node == static_cast<int>(id));
+        active.push_back(element_node);
+    });
+    CHECK((active == std::vector<int>{41, 700, 4000}));
+}
+
+namespace {
+    // Tracks the bytes held by every grid list, so that none are allocated outside of it
+    inline size_t allocated_bytes{0};
+
+    template<typename T>
+    struct counting_allocator {
+        using value_type = T;
+
+        counting_allocator() = default;
+        template<typename U>
+        counting_allocator(const counting_allocator<U>&) {}
+
+        T* allocate(size_t num) {
+            allocated_bytes += num*sizeof(T);
+            return std::allocator<T>{}.allocate(num);
+        }
+
+        void deallocate(T* pointer, size_t num) {
+            allocated_bytes -= num*sizeof(T);
+            std::allocator<T>{}.deallocate(pointer, num);
+        }
+
+        template<typename U>
+        bool operator==(const counting_allocator<U>&) const { return true; }
+    };
+
+    template<typename Config>
+    using config_grid = lightgrid::grid<int, 10, 16, Config>;
+
+    template<typename Grid>
+    std::vector<int> query_in_order(Grid& grid, const lightgrid::bounds& bounds) {
+        std::vector<int> results;
+        grid.query(bounds, results);
+        return results;
+    }
+}
+
+TEST(fixed_policies_match_runtime_policies) {
+    using fixed_config = lightgrid::config<lightgrid::dedupe::reference_point, lightgrid::ordering::by_element_node>;
+    using counted_config = lightgrid::config<lightgrid::dedupe::reference_point, lightgrid::runtime_policy{}, counting_allocator<int>>;
+
+    // A fixed policy isn't stored
+    CHECK(sizeof(config_grid<fixed_config>) < sizeof(test_grid));
+
+    {
+        test_grid runtime;
+        config_grid<fixed_config> fixed;
+        config_grid<counted_config> counted;
+
+        runtime.set_dedupe(lightgrid::dedupe::reference_point);
+        runtime.set_ordering(lightgrid::ordering::by_element_node);
+        counted.set_ordering(lightgrid::ordering::by_element_node);
+
+        std::vector<lightgrid::bounds> inserted;
+        for (int it{0}; it < 300; it++) {
+            inserted.push_back(lightgrid::bounds{(it*7919) % 800, (it*104729) % 800, (it % 4 == 0) ? 50 + it % 100 : it % 15, it % 20});
+        }
+
+        const auto apply = [&inserted](auto& grid) {
+            for (int it{0}; it < inserted.size(); it++) {
+                grid.insert(it, inserted[it]);
+            }
+
+            // Moved, so that the cell lists are no longer in insertion order
+            for (int it{0}; it < inserted.size(); it += 4) {
+                grid.update(it, inserted[it], lightgrid::bounds{inserted[it].y, inserted[it].x, inserted[it].w, inserted[it].h});
+            }
+
+            grid.insert(1000, lightgrid::circle{400.0f, 400.0f, 60.0f});
+            grid.insert(1001, lightgrid::bounds{20, 20, 5, 5}, lightgrid::motion{10.0f, 5.0f, 3.0f}, 0.0f);
+            grid.sleep(5);
+        };
+
+        apply(runtime);
+        apply(fixed);
+        apply(counted);
+
+        CHECK(allocated_bytes > 0);
+
+        for (int it{0}; it < 60; it++) {
+            const lightgrid::bounds query{(it*6271) % 850, (it*3323) % 850, (it*37) % 300, (it*53) % 250};
+            const std::vector<int> expected{query_in_order(runtime, query)};
+
+            CHECK(query_in_order(fixed, query) == expected);
+            CHECK(query_in_order(counted, query) == expected);
+
+            std::vector<int> active, fixed_active;
+            runtime.query_active(5, query, active);
+            fixed.query_active(5, query, fixed_active);
+            CHECK(fixed_active == active);
+        }
+    }
+
+    // Everything allocated by the grid's lists was given back through the same allocator
+    CHECK(allocated_bytes == 0);
+}
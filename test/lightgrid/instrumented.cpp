@@ -0,0 +1,115 @@
+#include <vector>
+
+#include <lightgrid/grid.hpp>
+
+#include "check.hpp"
+
+// Built into its own test executable with LIGHTGRID_LATENCY_HISTOGRAMS, LIGHTGRID_LATENCY_RDTSC and
+//      LIGHTGRID_EVENT_COUNTERS defined
+
+namespace {
+    using test_grid = lightgrid::grid<int, 10>;
+
+    void count_visit(int, void* user_data) {
+        (*static_cast<int*>(user_data))++;
+    }
+}
+
+TEST(event_counters_follow_cell_operations) {
+    test_grid grid;
+
+    // Three cells, then one more, all appended as the free list is empty
+    const int wide{grid.insert(1, lightgrid::bounds{0, 0, 25, 5})};
+    const int narrow{grid.insert(2, lightgrid::bounds{0, 0, 5, 5})};
+
+    lightgrid::event_counters counters{grid.counters()};
+    CHECK(counters.node_growths == 4);
+    CHECK(counters.free_list_hits == 0);
+    CHECK(counters.reallocations <= counters.node_growths);
+    CHECK(counters.nodes_visited == 0);
+
+    // The first cell holds both elements, and the wide element is seen again in the next two cells
+    std::vector<int> results;
+    grid.query(lightgrid::bounds{0, 0, 25, 5}, results);
+    CHECK(results.size() == 2);
+
+    counters = grid.counters();
+    CHECK(counters.nodes_visited == 4);
+    CHECK(counters.duplicates_rejected == 2);
+
+    // The wide element is behind the narrow one in the first cell, and alone in the others
+    grid.reset_counters();
+    grid.remove(wide);
+
+    counters = grid.counters();
+    CHECK(counters.remove_nodes_visited == 4);
+    CHECK(counters.nodes_visited == 0);
+
+    // The three freed cell nodes are reused before any are appended
+    grid.insert(3, lightgrid::bounds{10, 0, 5, 5});
+    grid.update(narrow, lightgrid::bounds{0, 0, 5, 5}, lightgrid::bounds{40, 0, 5, 5});
+
+    counters = grid.counters();
+    CHECK(counters.free_list_hits == 2);
+    CHECK(counters.node_growths == 0);
+    CHECK(counters.reallocations == 0);
+    CHECK(counters.remove_nodes_visited == 5);
+
+    // The update freed a node before using one, so two are left for the three cells
+    grid.insert(4, lightgrid::bounds{0, 0, 25, 5});
+
+    counters = grid.counters();
+    CHECK(counters.free_list_hits == 4);
+    CHECK(counters.node_growths == 1);
+
+    grid.reset_counters();
+    counters = grid.counters();
+    CHECK(counters.free_list_hits == 0 && counters.node_growths == 0 && counters.remove_nodes_visited == 0);
+}
+
+TEST(latency_histograms_record_every_operation) {
+    test_grid grid;
+
+    std::vector<int> nodes;
+    for (int it{0}; it < 50; it++) {
+        nodes.push_back(grid.insert(it, lightgrid::bounds{it*7, it*3, 10, 10}));
+    }
+
+    for (int it{0}; it < 20; it++) {
+        grid.update(nodes[it], lightgrid::bounds{it*7, it*3, 10, 10}, lightgrid::bounds{it*5, it*9, 10, 10});
+    }
+
+    for (int it{0}; it < 10; it++) {
+        grid.remove(nodes[it], lightgrid::bounds{it*5, it*9, 10, 10});
+    }
+
+    std::vector<int> results;
+    for (int it{0}; it < 30; it++) {
+        grid.query(lightgrid::bounds{it*10, it*10, 50, 50}, results);
+    }
+
+    int visited{0};
+    for (int it{0}; it < 15; it++) {
+        grid.visit(lightgrid::bounds{it*10, it*10, 50, 50}, count_visit, &visited);
+    }
+
+    CHECK(grid.latency(lightgrid::operation::insert).count() == 50);
+    CHECK(grid.latency(lightgrid::operation::update).count() == 20);
+    CHECK(grid.latency(lightgrid::operation::remove).count() == 10);
+    CHECK(grid.latency(lightgrid::operation::query).count() == 30);
+    CHECK(grid.latency(lightgrid::operation::visit).count() == 15);
+
+    const lightgrid::latency_histogram& inserts{grid.latency(lightgrid::operation::insert)};
+    CHECK(inserts.percentile(0.5) <= inserts.percentile(1.0));
+    CHECK(inserts.max() <= inserts.percentile(1.0));
+
+    // Copies take a snapshot, which is unaffected by later operations
+    const test_grid copy{grid};
+    grid.query(lightgrid::bounds{0, 0, 50, 50}, results);
+    CHECK(copy.latency(lightgrid::operation::query).count() == 30);
+    CHECK(grid.latency(lightgrid::operation::query).count() == 31);
+
+    grid.reset_latencies();
+    CHECK(grid.latency(lightgrid::operation::insert).count() == 0);
+    CHECK(grid.latency(lightgrid::operation::query).max() == 0);
+}
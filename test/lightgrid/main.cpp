@@ -0,0 +1,13 @@
+#include "check.hpp"
+
+int main() {
+    for (const auto& test : lightgrid_test::tests()) {
+        const int failures_before{lightgrid_test::failures};
+        test.run();
+        std::cout << (lightgrid_test::failures == failures_before ? "passed " : "FAILED ") << test.name << "\n";
+    }
+
+    std::cout << lightgrid_test::tests().size() << " tests, " << lightgrid_test::failures << " failed checks\n";
+
+    return lightgrid_test::failures == 0 ? 0 : 1;
+}
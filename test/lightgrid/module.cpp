@@ -0,0 +1,34 @@
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+import lightgrid;
+
+// Uses the grid only through the lightgrid module, so that a missing or unusable export fails to build or run
+int main() {
+    lightgrid::grid<int, 10> grid;
+
+    const int first{grid.insert(1, lightgrid::bounds{0, 0, 25, 25})};
+    grid.insert(2, lightgrid::bounds{100, 100, 5, 5});
+    grid.insert(3, lightgrid::circle{10.0f, 10.0f, 8.0f});
+
+    std::vector<int> results;
+    grid.query(lightgrid::bounds{0, 0, 20, 20}, results);
+    std::sort(results.begin(), results.end());
+
+    bool passed{results == std::vector<int>{1, 3}};
+
+    grid.remove(first);
+    results.clear();
+    grid.query(lightgrid::bounds{0, 0, 200, 200}, results);
+    passed = passed && results.size() == 2;
+
+    lightgrid::thread_pool pool{2};
+    int visited{0};
+    grid.parallel_visit(lightgrid::bounds{95, 95, 20, 20}, [&visited](int) { visited++; }, pool);
+    passed = passed && visited == 1;
+
+    std::cout << (passed ? "passed" : "FAILED") << " module_consumer\n";
+
+    return passed ? 0 : 1;
+}
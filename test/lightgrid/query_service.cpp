@@ -0,0 +1,80 @@
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include <lightgrid/grid.hpp>
+#include <lightgrid/query_service.hpp>
+
+#include "check.hpp"
+
+namespace {
+    using test_grid = lightgrid::grid<int, 10>;
+
+    lightgrid::bounds query_bounds(int thread, int it) {
+        return {(thread*211 + it*37) % 900, (thread*97 + it*53) % 900, 20 + it % 60, 20 + it % 45};
+    }
+
+    std::vector<int> sorted(std::vector<int> values) {
+        std::sort(values.begin(), values.end());
+        return values;
+    }
+}
+
+TEST(query_service_matches_grid) {
+    test_grid grid;
+
+    for (int it{0}; it < 500; it++) {
+        grid.insert(it, lightgrid::bounds{(it*7919) % 900, (it*104729) % 900, it % 30, it % 20});
+    }
+
+    constexpr int num_threads{4};
+    constexpr int queries_per_thread{200};
+
+    std::vector<std::vector<std::vector<int>>> answers(num_threads, std::vector<std::vector<int>>(queries_per_thread));
+    std::atomic<int> callbacks{0};
+
+    {
+        // Small batches, so that the queue is drained and refilled many times
+        lightgrid::query_service<test_grid> service{grid, 16};
+        std::vector<std::thread> threads;
+
+        for (int thread{0}; thread < num_threads; thread++) {
+            threads.emplace_back([&, thread] {
+                std::vector<std::future<std::vector<int>>> futures;
+
+                for (int it{0}; it < queries_per_thread; it++) {
+                    if (it % 2 == 0) {
+                        futures.push_back(service.query(query_bounds(thread, it)));
+                    } else {
+                        service.query(query_bounds(thread, it), [&, thread, it](std::vector<int>&& results) {
+                            answers[thread][it] = std::move(results);
+                            callbacks.fetch_add(1, std::memory_order_relaxed);
+                        });
+                    }
+                }
+
+                for (int it{0}; it < queries_per_thread; it += 2) {
+                    answers[thread][it] = futures[it/2].get();
+                }
+            });
+        }
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        // Every request made before the service is destroyed is answered
+    }
+
+    CHECK(callbacks.load() == num_threads*queries_per_thread/2);
+
+    for (int thread{0}; thread < num_threads; thread++) {
+        for (int it{0}; it < queries_per_thread; it++) {
+            std::vector<int> expected;
+            grid.query(query_bounds(thread, it), expected);
+            CHECK(sorted(answers[thread][it]) == sorted(expected));
+        }
+    }
+}
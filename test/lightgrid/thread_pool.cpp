@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include <lightgrid/grid.hpp>
+#include <lightgrid/thread_pool.hpp>
+
+#include "check.hpp"
+
+TEST(thread_pool_runs_each_task_once) {
+    lightgrid::thread_pool pool{4};
+
+    CHECK(pool.size() == 4);
+
+    // Uneven tasks and counts which don't split evenly, so that workers run out early and steal
+    for (size_t num_tasks : {0u, 1u, 3u, 4u, 17u, 1000u}) {
+        std::vector<std::atomic<int>> runs(num_tasks);
+
+        pool.run(num_tasks, [&](size_t task) {
+            volatile size_t spin{0};
+
+            for (size_t it{0}; it < (task % 7)*1000; it++) {
+                spin = spin + it;
+            }
+
+            runs[task].fetch_add(1, std::memory_order_relaxed);
+        });
+
+        // run only returns once every task has finished
+        for (size_t task{0}; task < num_tasks; task++) {
+            CHECK(runs[task].load() == 1);
+        }
+    }
+}
+
+TEST(thread_pool_of_one_runs_on_caller) {
+    lightgrid::thread_pool pool{1};
+    std::vector<size_t> order;
+
+    pool.run(5, [&](size_t task) {
+        order.push_back(task);
+    });
+
+    CHECK((order == std::vector<size_t>{0, 1, 2, 3, 4}));
+}
+
+TEST(parallel_visit_visits_each_element_once) {
+    lightgrid::grid<int, 10> grid;
+    constexpr int num_elements{500};
+
+    // Many elements span several cells, and so several tiles
+    for (int it{0}; it < num_elements; it++) {
+        grid.insert(it, lightgrid::bounds{(it*7919) % 900, (it*104729) % 900, (it % 3 == 0) ? 40 + it % 120 : it % 10, (it % 5 == 0) ? 70 + it % 60 : it % 10});
+    }
+
+    // Bounds starting and ending part way through tiles, from a single cell to the whole grid
+    const std::vector<lightgrid::bounds> queries{
+        {0, 0, 1000, 1000}, {13, 27, 611, 389}, {455, 455, 3, 3}, {95, 5, 740, 22}, {301, 77, 157, 803}
+    };
+
+    for (size_t num_workers : {1u, 4u}) {
+        lightgrid::thread_pool pool{num_workers};
+
+        for (const auto& bounds : queries) {
+            std::vector<std::atomic<int>> visits(num_elements);
+
+            grid.parallel_visit(bounds, [&](int element) {
+                visits[element].fetch_add(1, std::memory_order_relaxed);
+            }, pool);
+
+            std::vector<int> expected;
+            grid.query(bounds, expected);
+            std::sort(expected.begin(), expected.end());
+
+            std::vector<int> visited;
+            bool visited_once{true};
+
+            for (int element{0}; element < num_elements; element++) {
+                if (visits[element].load() > 0) {
+                    visited.push_back(element);
+                    visited_once = visited_once && visits[element].load() == 1;
+                }
+            }
+
+            CHECK(visited_once);
+            CHECK(visited == expected);
+        }
+    }
+}